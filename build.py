@@ -27,7 +27,8 @@ conf["VERBOSITY"] = 1
 conf["DUMP_RTL"] = False
 
 parsed, leftover = getopt(sys.argv[1:], "fdvq",
-                          ["force", "debug", "nogc", "verbose", "quiet", "call-graph"])
+                          ["force", "debug", "nogc", "verbose", "quiet", "call-graph",
+                           "mcache-stats", "nanbox"])
 if len(leftover) > 0:
     sys.stderr.write("'{0}' not understood".format(" ".join(leftover)))
     sys.exit(1)
@@ -45,6 +46,11 @@ for k, v in parsed:
     if k == "--call-graph":
         conf["CFLAGS"].append("-fdump-rtl-expand")
         conf["DUMP_RTL"] = True
+    if k == "--mcache-stats":
+        conf["CFLAGS"].append("-DMCACHE_STATS")
+    if k == "--nanbox":
+        # Full precision Doubles, 50-bit Integers (see vm/value_inline.c)
+        conf["CFLAGS"].append("-DVALUE_NANBOX")
 
 conf["RFLAGS"] = []
 conf["FORCING"] = choice_force
@@ -267,20 +273,29 @@ conf['RIPE'] = 'product/ripe'
 # TYPE MODULES
 
 type_deps = ['product/ripe']
-def type_module(module):
+# Default modules are typed without the defaults, which they are built with
+# (see build_module).  Other modules are typed with the defaults loaded, as
+# they are when built.
+def type_module(module, required, deps):
     path = 'modules/%s/%s.rip' % (module, module)
     out = 'product/modules/%s/%s.typ' % (module, module)
-    if tools.depends(out, type_deps + [path]):
+    if tools.depends(out, type_deps + deps + [path]):
         sys.stdout.write(tools.color_src + module + tools.color_reset + " ")
         tools.mkdir_safe('product/modules/%s' % module)
-        tools.call(['product/ripe', '-t', path, '>', out])
+        args = ['product/ripe', '-t', path]
+        if required:
+            args.append('--no-defaults')
+        tools.call(args + ['>', out])
     return out
 
 sys.stdout.write(" " + tools.color_flag +
                  "Generating module types... " + tools.color_reset)
 type_infos = []
-for module in MODULES + OPTIONAL_MODULES:
-    type_infos.append(type_module(module))
+for module in MODULES:
+    type_infos.append(type_module(module, True, []))
+def_type_infos = list(type_infos)
+for module in OPTIONAL_MODULES:
+    type_infos.append(type_module(module, False, def_type_infos))
 sys.stdout.write("\n")
 
 ##############################################################################
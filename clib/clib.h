@@ -155,10 +155,29 @@ void dict_iter_get_ptrs(DictIter* iter, void** key, void** value);
 ///////////////////////////////////////////////////////////////////////
 // hash.c
 ///////////////////////////////////////////////////////////////////////
-uint32 hash_bytes(const char * data, int len);
+uint64 hash_bytes_seed(const char* data, int64 len, uint64 seed);
+#define hash_bytes(data, len)  hash_bytes_seed(data, len, 0)
 #define hash_value(value)  hash_bytes((const char*) &value, sizeof(value))
 #define hash_string(str)   hash_bytes(str, strlen(str))
 
+// Finalizer of MurmurHash3: every bit of x affects every bit of the result.
+static inline uint64 hash_mix64(uint64 x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+// Order-sensitive: hash_combine(hash_combine(h, a), b) differs from
+// hash_combine(hash_combine(h, b), a).
+static inline uint64 hash_combine(uint64 h, uint64 v)
+{
+  return hash_mix64(h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2)));
+}
+
 ///////////////////////////////////////////////////////////////////////
 // mem.c
 ///////////////////////////////////////////////////////////////////////
@@ -317,6 +336,7 @@ typedef struct {
 
 void sarray_init(SArray* arr);
 void sarray_append_int(SArray* arr, int v);
+int sarray_get_int(SArray* arr, int idx);
 void sarray_pop(SArray* arr);
 int sarray_pop_int(SArray* arr);
 
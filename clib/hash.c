@@ -15,63 +15,101 @@
 
 #include "clib/clib.h"
 
-// This hash is taken from the code written by Paul Hsieh, retrieved from
+// This is wyhash (final version 4) by Wang Yi, which is in the public domain,
+// retrieved from
 //
-//   http://www.azillionmonkeys.com/qed/hash.html
+//   https://github.com/wangyi-fudan/wyhash
 
-#include <stdint.h>
-#undef get16bits
-#if (defined(__GNUC__) && defined(__i386__)) || defined(__WATCOMC__) \
-  || defined(_MSC_VER) || defined (__BORLANDC__) || defined (__TURBOC__)
-#define get16bits(d) (*((const uint16_t *) (d)))
-#endif
+static const uint64 wy_secret[4] = {
+  0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+  0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL
+};
 
-#if !defined (get16bits)
-#define get16bits(d) ((((uint32_t)(((const uint8_t *)(d))[1])) << 8)\
-                       +(uint32_t)(((const uint8_t *)(d))[0]) )
+static inline void wy_mum(uint64* a, uint64* b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = *a;
+  r *= *b;
+  *a = (uint64) r;
+  *b = (uint64) (r >> 64);
+#else
+  uint64 ha = *a >> 32, hb = *b >> 32;
+  uint64 la = (uint32) *a, lb = (uint32) *b;
+  uint64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64 t = rl + (rm0 << 32), c = t < rl;
+  uint64 lo = t + (rm1 << 32);
+  c += lo < t;
+  uint64 hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  *a = lo;
+  *b = hi;
 #endif
+}
 
-uint32 hash_bytes (const char * data, int len) {
-  uint32 hash = len, tmp;
-  int rem;
-
-  if (len <= 0 || data == NULL) return 0;
+static inline uint64 wy_mix(uint64 a, uint64 b)
+{
+  wy_mum(&a, &b);
+  return a ^ b;
+}
 
-  rem = len & 3;
-  len >>= 2;
+static inline uint64 wy_r8(const uint8* p)
+{
+  uint64 v;
+  memcpy(&v, p, 8);
+  return v;
+}
 
-  /* Main loop */
-  for (;len > 0; len--) {
-    hash  += get16bits (data);
-    tmp    = (get16bits (data+2) << 11) ^ hash;
-    hash   = (hash << 16) ^ tmp;
-    data  += 2*sizeof (uint16_t);
-    hash  += hash >> 11;
-  }
+static inline uint64 wy_r4(const uint8* p)
+{
+  uint32 v;
+  memcpy(&v, p, 4);
+  return v;
+}
 
-  /* Handle end cases */
-  switch (rem) {
-    case 3: hash += get16bits (data);
-            hash ^= hash << 16;
-            hash ^= data[sizeof (uint16_t)] << 18;
-            hash += hash >> 11;
-            break;
-    case 2: hash += get16bits (data);
-            hash ^= hash << 11;
-            hash += hash >> 17;
-            break;
-    case 1: hash += *data;
-            hash ^= hash << 10;
-            hash += hash >> 1;
-  }
+static inline uint64 wy_r3(const uint8* p, uint64 k)
+{
+  return (((uint64) p[0]) << 16) | (((uint64) p[k >> 1]) << 8) | p[k - 1];
+}
 
-  /* Force "avalanching" of final 127 bits */
-  hash ^= hash << 3;
-  hash += hash >> 5;
-  hash ^= hash << 4;
-  hash += hash >> 17;
-  hash ^= hash << 25;
-  hash += hash >> 6;
+uint64 hash_bytes_seed(const char* data, int64 len, uint64 seed)
+{
+  const uint8* p = (const uint8*) data;
+  const uint64* s = wy_secret;
+  uint64 a, b;
 
-  return hash;
+  seed ^= wy_mix(seed ^ s[0], s[1]);
+  if (len <= 16){
+    if (len >= 4){
+      a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+      b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0){
+      a = wy_r3(p, len);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    int64 i = len;
+    if (i > 48){
+      uint64 see1 = seed, see2 = seed;
+      do {
+        seed = wy_mix(wy_r8(p) ^ s[1], wy_r8(p + 8) ^ seed);
+        see1 = wy_mix(wy_r8(p + 16) ^ s[2], wy_r8(p + 24) ^ see1);
+        see2 = wy_mix(wy_r8(p + 32) ^ s[3], wy_r8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16){
+      seed = wy_mix(wy_r8(p) ^ s[1], wy_r8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = wy_r8(p + i - 16);
+    b = wy_r8(p + i - 8);
+  }
+  a ^= s[1];
+  b ^= seed;
+  wy_mum(&a, &b);
+  return wy_mix(a ^ s[0] ^ len, b ^ s[1]);
 }
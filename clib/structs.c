@@ -64,3 +64,19 @@ void* sarray_pop_ptr(SArray* arr)
   arr->size--;
   return arr->data[arr->size].p;
 }
+
+//            INT INTERFACE
+
+void sarray_append_int(SArray* arr, int v)
+{
+  sarray_expand(arr);
+  arr->data[arr->size].i = v;
+  arr->size++;
+}
+
+int sarray_get_int(SArray* arr, int idx)
+{
+  assert(arr != NULL); assert(idx >= 0); assert(idx < arr->size);
+
+  return arr->data[idx].i;
+}
@@ -23,6 +23,8 @@ void cache_prototype(const char* name)
   dict_set(&prototypes, &name, &i);
 
   wr_print(WR_HEADER, "%s;\n", util_signature(name));
+  if (util_has_unboxed(stran_get_function(name)))
+    wr_print(WR_HEADER, "%s;\n", util_unboxed_signature(name));
 }
 
 // Returns the name of the global static C variable of type Value that
@@ -47,6 +49,43 @@ const char* cache_dsym(const char* symbol)
   return dsym_c_var;
 }
 
+// Returns the name of the global static C variable of type Value that holds
+// a constant String with the given (C-escaped) text.
+static Dict tbl_strings; // string literal -> string name of C variable
+const char* cache_string(const char* text)
+{
+  char* str_c_var;
+  if (dict_query(&tbl_strings, &text, &str_c_var))
+    return str_c_var;
+
+  static uint64 counter = 0;
+  counter++;
+  str_c_var = mem_asprintf("_str%"PRIu64, counter);
+  wr_print(WR_HEADER, "static Value %s;\n", str_c_var);
+  wr_print(WR_INIT2, "  %s = string_const_to_val(\"%s\");\n",
+                         str_c_var, text);
+  dict_set(&tbl_strings, &text, &str_c_var);
+  return str_c_var;
+}
+
+// Returns the name of the global static C variable of type Value that holds
+// the function object of the given static symbol.
+static Dict tbl_ssym; // static symbol -> string name of C variable
+const char* cache_ssym(const char* ssym)
+{
+  char* ssym_c_var;
+  if (dict_query(&tbl_ssym, &ssym, &ssym_c_var))
+    return ssym_c_var;
+
+  static uint64 counter = 0;
+  counter++;
+  ssym_c_var = mem_asprintf("_ssym%"PRIu64"_%s", counter, util_escape(ssym));
+  wr_print(WR_HEADER, "static Value %s;\n", ssym_c_var);
+  wr_print(WR_INIT2, "  %s = ssym_get(\"%s\");\n", ssym_c_var, ssym);
+  dict_set(&tbl_ssym, &ssym, &ssym_c_var);
+  return ssym_c_var;
+}
+
 // Returns the name of the global static C variable of type Klass* that
 // corresponds to that typename.
 static Dict tbl_types; // type name -> string name of C variable of type Klass*
@@ -69,6 +108,20 @@ const char* cache_type(const char* type)
   return klassp_c_var;
 }
 
+// Returns the name of a fresh static C variable of type MethodCache.  Unlike
+// the other caches, every call site gets its own, and each thread its own
+// copy of it (see method_cache_get).
+const char* cache_method(const char* method)
+{
+  static uint64 counter = 0;
+  counter++;
+  const char* mc_c_var = mem_asprintf("_mcache%"PRIu64"_%s",
+                                      counter,
+                                      util_escape(method));
+  wr_print(WR_HEADER, "static THREAD_LOCAL MethodCache %s;\n", mc_c_var);
+  return mc_c_var;
+}
+
 static Dict global_prototypes;
 void cache_global_prototype(const char* global)
 {
@@ -84,6 +137,8 @@ void cache_init()
 {
   dict_init_string(&tbl_dsym, sizeof(char*));
   dict_init_string(&tbl_types, sizeof(char*));
+  dict_init_string(&tbl_strings, sizeof(char*));
+  dict_init_string(&tbl_ssym, sizeof(char*));
   dict_init_string(&prototypes, sizeof(int));
   dict_init_string(&global_prototypes, sizeof(int));
 }
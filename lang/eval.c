@@ -18,30 +18,109 @@
 EE* ee_new(const char* type, const char* text)
 {
   EE* ee = mem_new(EE);
-  if (type != UNTYPED) ee->type = mem_strdup(type);
+  ee->type = (type == UNTYPED) ? NULL : mem_strdup(type);
   ee->text = mem_strdup(text);
   return ee;
 }
 
+static bool ee_is(EE* ee, const char* type)
+{
+  return ee->type != NULL and strequal(ee->type, type);
+}
+
 const char* ee_Value(EE* ee)
 {
-  if (strequal(ee->type, "int64")){
+  if (ee_is(ee, "int64")){
     return mem_asprintf("int64_to_val(%s)", ee->text);
   }
-  if (strequal(ee->type, "double")){
+  if (ee_is(ee, "double")){
     return mem_asprintf("double_to_val(%s)", ee->text);
   }
-  if (strequal(ee->type, "bool")){
+  if (ee_is(ee, "bool")){
     return mem_asprintf("pack_bool(%s)", ee->text);
   }
   return ee->text;  
 }
 
-const char* ee_type(const char* type, EE* ee)
+// Returns C code of ee as an unboxed int64 or double (setting *is_double), or
+// NULL if ee is not statically a number.  Values declared Integer or Double
+// are unboxed with a check.
+static const char* ee_numeric(EE* ee, bool* is_double)
+{
+  *is_double = false;
+  if (ee_is(ee, "int64")) return ee->text;
+  if (ee_is(ee, "Integer")) return mem_asprintf("val_to_int64(%s)", ee->text);
+  *is_double = true;
+  if (ee_is(ee, "double")) return ee->text;
+  if (ee_is(ee, "Double")) return mem_asprintf("val_to_double(%s)", ee->text);
+  return NULL;
+}
+
+// Returns C code of an int64 evaluating expr, which must be an Integer.
+static const char* eval_int64(Node* expr)
 {
+  return ee_type("int64", eval_expr(expr));
+}
+
+// Natively evaluate a unary operator on a typed operand, or return NULL.
+static EE* eval_unary_native(Node* expr, EE* ee)
+{
+  const char* c_op;
+  int native = unary_op_native(expr->type, &c_op);
+  bool is_double;
+  const char* e = ee_numeric(ee, &is_double);
+  if (e == NULL) return NULL;
+  switch(native){
+    case OPER_NUMERIC:
+      return ee_new(is_double ? "double" : "int64",
+                    mem_asprintf("(%s%s)", c_op, e));
+    case OPER_INTEGER:
+      if (is_double) return NULL;
+      return ee_new("int64", mem_asprintf("(%s%s)", c_op, e));
+  }
   return NULL;
 }
 
+// Natively evaluate a binary operator on typed operands, or return NULL.
+static EE* eval_binary_native(Node* expr, EE* ee1, EE* ee2)
+{
+  const char* c_op;
+  int native = binary_op_native(expr->type, &c_op);
+  if (native == OPER_NEVER) return NULL;
+
+  bool is_double1, is_double2;
+  const char* e1 = ee_numeric(ee1, &is_double1);
+  const char* e2 = ee_numeric(ee2, &is_double2);
+  if (e1 == NULL or e2 == NULL) return NULL;
+  const char* text = mem_asprintf("(%s %s %s)", e1, c_op, e2);
+  bool is_double = is_double1 or is_double2;
+
+  switch(native){
+    case OPER_NUMERIC:
+      return ee_new(is_double ? "double" : "int64", text);
+    case OPER_BOOL_NUMERIC:
+      return ee_new("bool", text);
+    case OPER_INTEGER:
+      if (is_double) return NULL;
+      return ee_new("int64", text);
+    case OPER_BOOL_INTEGER:
+      if (is_double) return NULL;
+      return ee_new("bool", text);
+  }
+  return NULL;
+}
+
+const char* ee_type(const char* type, EE* ee)
+{
+  if (strequal(type, "int64") or strequal(type, "double")){
+    bool is_double;
+    const char* e = ee_numeric(ee, &is_double);
+    if (e != NULL and (strequal(type, "double") or not is_double)) return e;
+    return mem_asprintf("val_to_%s(%s)", type, ee_Value(ee));
+  }
+  return ee_Value(ee);
+}
+
 static const char* eval_expr_list(Node* expr_list, bool first_comma)
 {
   assert(expr_list->type == EXPR_LIST);
@@ -64,7 +143,7 @@ static const char* eval_expr_list(Node* expr_list, bool first_comma)
 }
 
 
-static const char* eval_static_call(const char* ssym, Node* arg_list)
+static EE* eval_static_call(const char* ssym, Node* arg_list)
 {
   FuncInfo* fi = stran_get_function(ssym);
   if (fi == NULL){
@@ -90,7 +169,27 @@ static const char* eval_static_call(const char* ssym, Node* arg_list)
   }
 
   cache_prototype(ssym); // Make certain the C compiler knows fi->c_name
+
+  // Call the unboxed entry point directly, if there is one.
+  if (lang_optims & OPTIM_FUNC_CALLS and util_has_unboxed(fi)){
+    const char* buf = mem_asprintf("unboxed_%s(", fi->c_name);
+    for (int i = 0; i < num_args; i++){
+      EE* ee = eval_expr(node_get_child(arg_list, i));
+      const char* type = util_unboxed_type(fi->param_types[i]);
+      buf = mem_asprintf("%s%s%s", buf, i == 0 ? "" : ", ",
+                         type == NULL ? ee_Value(ee) : ee_type(type, ee));
+    }
+    buf = mem_asprintf("%s)", buf);
+    const char* ret = util_unboxed_type(fi->ret);
+    return ee_new(ret == NULL ? UNTYPED : ret, buf);
+  }
+
+  // Without OPTIM_FUNC_CALLS, go through the function object.
   const char* buf = mem_asprintf("%s(", fi->c_name);
+  if (not (lang_optims & OPTIM_FUNC_CALLS)){
+    buf = mem_asprintf("func_call%d(%s%s", num_params, cache_ssym(ssym),
+                       min_params > 0 or is_vararg ? ", " : "");
+  }
   for (int i = 0; i < min_params; i++){
     Node* arg = node_get_child(arg_list, i);
     if (i == 0)
@@ -112,23 +211,175 @@ static const char* eval_static_call(const char* ssym, Node* arg_list)
   }
   buf = mem_asprintf("%s)", buf);
 
-  return buf;
+  return ee_new(UNTYPED, buf);
+}
+
+// Returns the method that a call on a receiver of the given type resolves to,
+// or NULL if it is not statically known.
+static FuncInfo* eval_method(const char* type, const char* method_name,
+                             int num_args)
+{
+  if (type == NULL or strequal(type, "?")) return NULL;
+  if (strequal(type, "int64")) type = "Integer";
+  if (strequal(type, "double")) type = "Double";
+  if (strequal(type, "bool")) type = "Bool";
+  ClassInfo* ci = stran_query_class(type);
+  if (ci == NULL) return NULL;
+  FuncInfo* fi = NULL;
+  dict_query(&(ci->methods), &method_name, &fi);
+  if (fi == NULL or fi->num_params != num_args + 1) return NULL;
+  if (strequal(fi->param_types[fi->num_params - 1], "*")) return NULL;
+  return fi;
 }
 
 static const char* eval_obj_call(Node* obj, const char* method_name,
                              Node* expr_list)
 {
-  return mem_asprintf("method_call%d(%s, %s %s)",
-                      node_num_children(expr_list),
-                      eval_Value(obj),
+  EE* ee = eval_expr(obj);
+  int num_args = node_num_children(expr_list);
+
+  // A receiver of a known type (other than self, which may be an instance of
+  // a subclass) can call the method directly.
+  bool is_self = (obj->type == ID and strequal(obj->text, "self"));
+  if (lang_optims & OPTIM_TYPES and not is_self){
+    FuncInfo* fi = eval_method(ee->type, method_name, num_args);
+    if (fi != NULL){
+      cache_prototype(fi->ripe_name);
+      return mem_asprintf("%s(%s%s)", fi->c_name, ee_Value(ee),
+                          eval_expr_list(expr_list, true));
+    }
+  }
+
+  return mem_asprintf("method_call%d_cached(&%s, %s, %s %s)",
+                      num_args,
+                      cache_method(method_name),
+                      ee_Value(ee),
                       cache_dsym(method_name),
                       eval_expr_list(expr_list, true));
 }
 
+// Returns the property of a field class that can be accessed through its slot,
+// or NULL if type is not known to be such a class.
+static PropInfo* eval_prop(const char* type, const char* field, bool assign)
+{
+  if (type == NULL) return NULL;
+  ClassInfo* ci = stran_query_class(type);
+  if (ci == NULL or ci->type != CLASS_FIELD) return NULL;
+  // Virtual readers and writers take precedence over the field.
+  if (dict_query(assign ? &(ci->vs_methods) : &(ci->vg_methods), &field, NULL))
+    return NULL;
+  PropInfo* pi = NULL;
+  dict_query(&(ci->props), &field, &pi);
+  return pi;
+}
+
+// Returns code for reading field of obj (if assign = NULL), or setting it to
+// the already evaluated assign.  If obj is NULL, this is @field.
+//
+// Self (and @field) is at least of the class being compiled, and subclasses
+// only append slots, so its slots are accessed directly.  Other receivers of
+// a declared type get a guarded access, since declared types are not verified
+// under OPTIM_TYPE_VERIFY.  Everything else goes through field_get/field_set.
+const char* eval_field(Node* obj, const char* field, const char* assign)
+{
+  const char* obj_c = "__self";
+  const char* type = NULL;
+  bool is_self = true;
+  if (obj == NULL){
+    if (context_ci != NULL) type = context_ci->ripe_name;
+  } else {
+    EE* ee = eval_expr(obj);
+    obj_c = ee_Value(ee);
+    type = ee->type;
+    is_self = (obj->type == ID and strequal(obj->text, "self")
+               and context_ci != NULL);
+  }
+
+  const char* dsym = cache_dsym(field);
+  PropInfo* pi = eval_prop(type, field, assign != NULL);
+  if (pi == NULL){
+    if (assign == NULL) return mem_asprintf("field_get(%s, %s)", obj_c, dsym);
+    return mem_asprintf("field_set(%s, %s, %s)", obj_c, dsym, assign);
+  }
+  if (is_self){
+    if (assign == NULL) return mem_asprintf("obj_slot(%s, %d)", obj_c, pi->num);
+    return mem_asprintf("obj_slot(%s, %d) = %s", obj_c, pi->num, assign);
+  }
+  if (assign == NULL){
+    return mem_asprintf("field_get_slot(%s, %s, %d, %s)",
+                        obj_c, cache_type(type), pi->num, dsym);
+  }
+  return mem_asprintf("field_set_slot(%s, %s, %d, %s, %s)",
+                      obj_c, cache_type(type), pi->num, dsym, assign);
+}
+
+// Indexing an array variable with loop variables known to be in range (see
+// BoundsFact) reads the element directly.  Returns NULL if that is not the
+// case.
+static const char* eval_index_unchecked(Node* self, Node* idx, Node* assign)
+{
+  if (not (lang_optims & OPTIM_BOUNDS)) return NULL;
+  if (self->type != ID or not var_query(self->text)) return NULL;
+  const char* type = var_query_type(self->text);
+  if (type == NULL) return NULL;
+  int dims;
+  if (strequal(type, "Array1") or strequal(type, "Num.Array1")) dims = 1;
+  else if (strequal(type, "Array2") or strequal(type, "Num.Array2")) dims = 2;
+  else return NULL;
+  if (node_num_children(idx) != dims) return NULL;
+
+  BoundsFact* facts[2];
+  const char* c_idx[2];
+  for (int d = 0; d < dims; d++){
+    Node* n = node_get_child(idx, d);
+    if (n->type != ID) return NULL;
+    facts[d] = bounds_query(self->text, d + 1, n->text);
+    if (facts[d] == NULL) return NULL;
+    c_idx[d] = ee_type("int64", eval_expr(n));
+  }
+  const char* p = facts[0]->c_data;
+  const char* x = c_idx[0];
+  const char* c_elem;
+  if (strequal(type, "Array1")){
+    // The body may have resized the Array1, so its size is still checked.
+    if (assign == NULL) return mem_asprintf("array1_index_fast(%s, %s)", p, x);
+    return mem_asprintf("array1_index_set_fast(%s, %s, %s)", p, x,
+                        eval_Value(assign));
+  } else if (strequal(type, "Num.Array1")){
+    c_elem = mem_asprintf("%s ? (uint64) (%s - 1) : num_array1_index(%s, %s)",
+                          facts[0]->c_inbounds, x, p, x);
+  } else {
+    const char* y = c_idx[1];
+    const char* guard = mem_asprintf("(%s and %s)", facts[0]->c_inbounds,
+                                     facts[1]->c_inbounds);
+    if (strequal(type, "Array2")){
+      c_elem = mem_asprintf("%s->data[%s ? (%s - 1) + (%s - 1) * (int64) %s->size_y "
+                            ": array2_index(%s, %s, %s)]",
+                            p, guard, y, x, p, p, x, y);
+    } else {
+      c_elem = mem_asprintf("%s ? (%s - 1) * %s->size_x + %s - 1 "
+                            ": num_array2_index(%s, %s, %s)",
+                            guard, y, p, x, p, x, y);
+    }
+  }
+
+  if (strequal(type, "Array2")){
+    if (assign == NULL) return c_elem;
+    return mem_asprintf("%s = %s", c_elem, eval_Value(assign));
+  }
+  if (assign == NULL)
+    return mem_asprintf("num_get(%s->type, %s->data, %s)", p, p, c_elem);
+  return mem_asprintf("num_set(%s->type, %s->data, %s, %s)", p, p, c_elem,
+                      eval_Value(assign));
+}
+
 // Returns code for accessing index (if assign = NULL), or setting index
 // when assign is of type expr.
 const char* eval_index(Node* self, Node* idx, Node* assign)
 {
+  const char* unchecked = eval_index_unchecked(self, idx, assign);
+  if (unchecked != NULL) return unchecked;
+
   if (assign == NULL) {
     return eval_obj_call(self, "index", idx);
   } else {
@@ -175,17 +426,26 @@ const char* eval_type(Node* n)
 
 EE* eval_expr(Node* expr)
 {
-  if (is_unary_op(expr))
+  if (is_unary_op(expr)){
+    EE* ee = eval_expr(node_get_child(expr, 0));
+    EE* result = eval_unary_native(expr, ee);
+    if (result != NULL) return result;
     return ee_new(UNTYPED, 
                   mem_asprintf("%s(%s)",
                                unary_op_map(expr->type),
-                               eval_Value(node_get_child(expr, 0))));
-  if (is_binary_op(expr))
+                               ee_Value(ee)));
+  }
+  if (is_binary_op(expr)){
+    EE* ee1 = eval_expr(node_get_child(expr, 0));
+    EE* ee2 = eval_expr(node_get_child(expr, 1));
+    EE* result = eval_binary_native(expr, ee1, ee2);
+    if (result != NULL) return result;
     return ee_new (UNTYPED, 
                    mem_asprintf("%s(%s, %s)",
                                 binary_op_map(expr->type),
-                                eval_Value(node_get_child(expr, 0)),
-                                eval_Value(node_get_child(expr, 1))));
+                                ee_Value(ee1),
+                                ee_Value(ee2)));
+  }
 
   switch(expr->type){
   case K_TRUE:
@@ -204,29 +464,31 @@ EE* eval_expr(Node* expr)
       else 
         return ee_new(var_query_type(expr->text),
                       closure_add(expr->text, var_query_c_name(expr->text)));
+    } else if (var_query_kind(expr->text) == VAR_UNBOXED){
+      return ee_new(util_unboxed_type(var_query_type(expr->text)),
+                    util_unboxed_c_name(expr->text));
     } else return ee_new(var_query_type(expr->text), var_query_c_name(expr->text));
   case SYMBOL:
     return ee_new("Integer", cache_dsym(expr->text + 1));
   case INT:
-    return ee_new("Integer", mem_asprintf("int64_to_val(%s)", expr->text));
+    return ee_new("int64", mem_asprintf("((int64) %s)", expr->text));
   case DOUBLE:
-    return ee_new("Double", mem_asprintf("double_to_val(%s)", expr->text));
+    return ee_new("double", expr->text);
   case STRING:
     {
-      const char* str = expr->text;
-      return ee_new("String", mem_asprintf("string_to_val(\"%s\")", str));
+      return ee_new("String", cache_string(expr->text));
     }
     break;
   case CHARACTER:
     {
       const char* str = expr->text;
-      return ee_new("Integer", mem_asprintf("int64_to_val(%d)", (int) str[1]));
+      return ee_new("int64", mem_asprintf("((int64) %d)", (int) str[1]));
     }
     break;
   case EXPR_ARRAY:
     {
       Node* expr_list = node_get_child(expr, 0);
-      return ee_new("Array", mem_asprintf("array1_to_val2(%u %s)",
+      return ee_new("Array1", mem_asprintf("array1_to_val2(%u %s)",
                                           expr_list->children.size,
                                           eval_expr_list(expr_list, true)));
     }
@@ -297,7 +559,7 @@ EE* eval_expr(Node* expr)
 
         // If all of callee can be evaluated as an id, then it must be a static
         // call.
-        return ee_new(UNTYPED, eval_static_call(s, args));
+        return eval_static_call(s, args);
       }
       
 
@@ -311,21 +573,18 @@ EE* eval_expr(Node* expr)
       Node* left = node_get_child(expr, 0);
       Node* right = node_get_child(expr, 1);
       return ee_new("Range",
-                    mem_asprintf("range_to_val(RANGE_BOUNDED, "
-                                 "val_to_int64(%s), val_to_int64(%s))",
-                                 eval_Value(left),
-                                 eval_Value(right)));
+                    mem_asprintf("range_to_val(RANGE_BOUNDED, %s, %s)",
+                                 eval_int64(left),
+                                 eval_int64(right)));
     }
   case EXPR_RANGE_BOUNDED_LEFT:
     return ee_new("Range", 
-                  mem_asprintf("range_to_val(RANGE_BOUNDED_LEFT, "
-                               "val_to_int64(%s), 0)",
-                               eval_Value(node_get_child(expr, 0))));
+                  mem_asprintf("range_to_val(RANGE_BOUNDED_LEFT, %s, 0)",
+                               eval_int64(node_get_child(expr, 0))));
   case EXPR_RANGE_BOUNDED_RIGHT:
     return ee_new("Range",
-                  mem_asprintf("range_to_val(RANGE_BOUNDED_RIGHT, "
-                               "0, val_to_int64(%s))",
-                               eval_Value(node_get_child(expr, 0))));
+                  mem_asprintf("range_to_val(RANGE_BOUNDED_RIGHT, 0, %s)",
+                               eval_int64(node_get_child(expr, 0))));
   case EXPR_RANGE_UNBOUNDED:
     return ee_new("Range", "range_to_val(RANGE_UNBOUNDED, 0, 0)");
   case EXPR_FIELD:
@@ -337,10 +596,7 @@ EE* eval_expr(Node* expr)
         // Dynamic field.
         const char* field = node_get_string(expr, "name");
 
-        return ee_new(UNTYPED, 
-                      mem_asprintf("field_get(%s, %s)",
-                                   eval_Value(left),
-                                   cache_dsym(field)));
+        return ee_new(UNTYPED, eval_field(left, field, NULL));
       } else {
         // Could be a global variable.
         s = eval_expr_as_id(expr);
@@ -360,8 +616,7 @@ EE* eval_expr(Node* expr)
       if (context_ci->type != CLASS_FIELD){
         fatal_node(expr, "'@%s' in a class that's not a field class", name);
       }
-      return ee_new(UNTYPED,
-                    mem_asprintf("field_get(__self, %s)", cache_dsym(name)));
+      return ee_new(UNTYPED, eval_field(NULL, name, NULL));
     }
   case C_CODE:
     {
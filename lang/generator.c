@@ -71,6 +71,72 @@ void fatal_node(Node* node, const char* format, ...)
 FuncInfo* context_fi = NULL;
 ClassInfo* context_ci = NULL;
 BlockContext* context_block = NULL;
+int lang_optims = OPTIM_FOR_LOOPS | OPTIM_TYPES | OPTIM_FUNC_CALLS
+                  | OPTIM_BOUNDS;
+
+///////////////////////////////////////////////////////////////////////////////
+// BOUNDS FACTS
+///////////////////////////////////////////////////////////////////////////////
+
+static SArray bounds_facts;
+
+BoundsFact* bounds_query(const char* array, int dim, const char* index)
+{
+  for (int i = bounds_facts.size - 1; i >= 0; i--){
+    BoundsFact* fact = sarray_get_ptr(&bounds_facts, i);
+    if (fact->block == context_block and fact->dim == dim
+        and strequal(fact->array, array) and strequal(fact->index, index))
+      return fact;
+  }
+  return NULL;
+}
+
+// Returns the C structure of an array variable of the given type whose size
+// along dimension *dim is read by field, or NULL if there is none.
+static const char* bounds_c_struct(const char* type, const char* field,
+                                   int* dim)
+{
+  if (type == NULL) return NULL;
+  if (strequal(field, "size")){
+    *dim = 1;
+    if (strequal(type, "Array1")) return "Array1";
+    if (strequal(type, "Num.Array1")) return "NumArray1";
+    return NULL;
+  }
+  if (strequal(field, "size_x")) *dim = 1;
+  else if (strequal(field, "size_y")) *dim = 2;
+  else return NULL;
+  if (strequal(type, "Array2")) return "Array2";
+  if (strequal(type, "Num.Array2")) return "NumArray2";
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// GENERATOR FRAMES
+///////////////////////////////////////////////////////////////////////////////
+
+// The locals of a generator function live in its frame, so that they survive
+// a yield.  frame_fields maps the C name of each of them to its C type.  It is
+// NULL outside of generator functions.
+static Dict* frame_fields = NULL;
+static int frame_yields;
+
+static bool in_frame(void)
+{
+  return frame_fields != NULL and context_block == NULL;
+}
+
+// Declares a C local of type c_type.  Returns what replaces "c_type c_name"
+// in the declaration.  In a generator the local becomes a field of the
+// frame, and *c_name is changed to refer to it.
+static const char* gen_decl(const char* c_type, const char** c_name)
+{
+  if (not in_frame()) return mem_asprintf("%s %s", c_type, *c_name);
+  if (strncmp(c_type, "const ", 6) == 0) c_type += 6;
+  dict_set(frame_fields, (void*) c_name, &c_type);
+  *c_name = mem_asprintf("_frame->%s", *c_name);
+  return *c_name;
+}
 
 ///////////////////////////////////////////////////////////////////////////////
 // BLOCK STUFF
@@ -92,37 +158,74 @@ const char* closure_add(const char* name, const char* evaluated)
                       context_block->closure_names.size - 1);
 }
 
+// Returns right as a Value to be stored in a variable of the given type.
+// Unless OPTIM_TYPE_VERIFY, the type is verified at run-time when it is not
+// statically known.  Integers stored in a Double are converted.
+static const char* gen_typesafe(EE* right, const char* type)
+{
+  if (strequal(type, "?")) return ee_Value(right);
+  if (right->type != NULL){
+    if (strequal(right->type, type)) return ee_Value(right);
+    const char* unboxed = util_unboxed_type(type);
+    if (unboxed != NULL and strequal(right->type, unboxed))
+      return ee_Value(right);
+    if (strequal(type, "Bool") and strequal(right->type, "bool"))
+      return ee_Value(right);
+  }
+  if (lang_optims & OPTIM_TYPE_VERIFY) return ee_Value(right);
+  if (strequal(type, "Double"))
+    return mem_asprintf("double_to_val(%s)", ee_type("double", right));
+  return mem_asprintf("obj_verify_assign(%s, %s)", ee_Value(right),
+                      cache_type(type));
+}
+
+// Assignment to a variable (lvalue of type ID or EXPR_TYPED_ID).
+static const char* gen_assign_var(Node* lvalue, EE* right)
+{
+  StringBuf sb;
+  sbuf_init(&sb, "");
+
+  if (lvalue->type == EXPR_TYPED_ID){
+    const char* var_name = node_get_string(lvalue, "name");
+    const char* c_name = util_c_name(var_name);
+    const char* type = eval_type(node_get_node(lvalue, "type"));
+    const char* verified = gen_typesafe(right, type);
+    sbuf_printf(&sb, "  %s = %s;\n", gen_decl("Value", &c_name), verified);
+    var_add_local(var_name, c_name, type);
+    return sb.str;
+  }
+
+  const char* var_name = lvalue->text;
+  if (var_query(var_name)){
+    const char* type = var_query_type(var_name);
+    sbuf_printf(&sb, "  %s = %s;\n", var_query_c_name(var_name),
+                gen_typesafe(right, type));
+    if (var_query_kind(var_name) == VAR_UNBOXED){
+      sbuf_printf(&sb, "  %s = val_to_%s(%s);\n",
+                  util_unboxed_c_name(var_name), util_unboxed_type(type),
+                  var_query_c_name(var_name));
+    }
+  } else {
+    // Register the variable (untyped)
+    const char* c_name = util_c_name(var_name);
+    const char* value = ee_Value(right);
+    sbuf_printf(&sb, "  %s = %s;\n", gen_decl("Value", &c_name), value);
+    var_add_local(var_name, c_name, "?");
+  }
+  return sb.str;
+}
+
 static const char* gen_stmt_assign2(Node* lvalue, 
                                     Node* rvalue) ATTR_WARN_UNUSED_RESULT;
 static const char* gen_stmt_assign2(Node* lvalue, Node* rvalue)
 {
+  if (lvalue->type == ID or lvalue->type == EXPR_TYPED_ID)
+    return gen_assign_var(lvalue, eval_expr(rvalue));
+
   StringBuf sb;
   sbuf_init(&sb, "");
 
-  const char* right = eval_Value(rvalue);
   switch(lvalue->type){
-  case ID:
-    {
-      const char* var_name = lvalue->text;
-      if (var_query(var_name)){
-        sbuf_printf(&sb, "  %s = %s;\n", var_query_c_name(var_name), right);
-      } else {
-        // Register the variable (untyped)
-        const char* c_name = util_c_name(var_name);
-        var_add_local(var_name, c_name, "?");
-        sbuf_printf(&sb, "  Value %s = %s;\n", c_name, right);
-      }
-    }
-    break;
-  case EXPR_TYPED_ID:
-    {
-      const char* var_name = node_get_string(lvalue, "name");
-      const char* c_name = util_c_name(var_name);
-      const char* type = eval_type(node_get_node(lvalue, "type"));
-      var_add_local(var_name, c_name, type);
-      sbuf_printf(&sb, "  Value %s = %s;\n", c_name, right);
-    }
-    break;
   case EXPR_INDEX:
     sbuf_printf(&sb, "  %s;\n",
                 eval_index(node_get_child(lvalue, 0),
@@ -130,15 +233,15 @@ static const char* gen_stmt_assign2(Node* lvalue, Node* rvalue)
                            rvalue));
     break;
   case EXPR_FIELD:
-    sbuf_printf(&sb, "  field_set(%s, %s, %s);\n",
-                eval_Value(node_get_child(lvalue, 0)),
-                cache_dsym(node_get_string(lvalue, "name")),
-                right);
+    sbuf_printf(&sb, "  %s;\n",
+                eval_field(node_get_child(lvalue, 0),
+                           node_get_string(lvalue, "name"),
+                           eval_Value(rvalue)));
     break;
   case EXPR_AT_VAR:
-    sbuf_printf(&sb, "  field_set(__self, %s, %s);\n",
-             cache_dsym(node_get_string(lvalue, "name")),
-             right);
+    sbuf_printf(&sb, "  %s;\n",
+                eval_field(NULL, node_get_string(lvalue, "name"),
+                           eval_Value(rvalue)));
     break;
   default:
     assert_never();
@@ -176,6 +279,650 @@ static const char* gen_stmt_assign(Node* left, Node* right)
   return sb.str;
 }
 
+// Returns true if n (outside of blocks) assigns to variable name, or uses it
+// as a loop variable.
+static bool node_assigns(Node* n, const char* name)
+{
+  if (n->type == EXPR_BLOCK) return false;
+  if (n->type == STMT_ASSIGN or n->type == STMT_FOR){
+    Node* lvalues = node_get_child(n, 0);
+    for (int i = 0; i < node_num_children(lvalues); i++){
+      Node* lvalue = node_get_child(lvalues, i);
+      if (lvalue->type == ID and strequal(lvalue->text, name)) return true;
+    }
+  }
+  for (int i = 0; i < node_num_children(n); i++){
+    if (node_assigns(node_get_child(n, i), name)) return true;
+  }
+  DictIter* iter = dict_iter_new(&(n->props_nodes));
+  while (dict_iter_has(iter)){
+    const char* key; Node* child;
+    dict_iter_get_ptrs(iter, (void**) &key, (void**) &child);
+    if (node_assigns(child, name)) return true;
+  }
+  return false;
+}
+
+// For loops over a single variable and a Range become a loop over an int64.
+// Range literals are not even allocated.  ee is the evaluated Range, or NULL
+// if it is a literal.  Returns NULL if the loop cannot be optimized.
+static const char* gen_stmt_for_range(Node* stmt, EE* ee)
+{
+  Node* lvalue_list = node_get_child(stmt, 0);
+  Node* expr = node_get_child(stmt, 1);
+  Node* block = node_get_child(stmt, 2);
+  if (node_num_children(lvalue_list) != 1) return NULL;
+  Node* lvalue = node_get_child(lvalue_list, 0);
+  if (lvalue->type != ID and lvalue->type != EXPR_TYPED_ID) return NULL;
+
+  static int counter = 0;
+  counter++;
+  const char* c_i = mem_asprintf("_i%d", counter);
+  const char* c_delta = mem_asprintf("_delta%d", counter);
+  const char* c_finish = mem_asprintf("_finish%d", counter);
+
+  StringBuf sb;
+  sbuf_init(&sb, "");
+  const char* decl_i = gen_decl("int64", &c_i);
+  const char* decl_finish = gen_decl("const int64", &c_finish);
+  const char* decl_delta = gen_decl("const int64", &c_delta);
+  switch(expr->type){
+  case EXPR_RANGE_BOUNDED:
+    sbuf_printf(&sb, "  %s = %s;\n", decl_i,
+                ee_type("int64", eval_expr(node_get_child(expr, 0))));
+    sbuf_printf(&sb, "  %s = %s;\n", decl_finish,
+                ee_type("int64", eval_expr(node_get_child(expr, 1))));
+    sbuf_printf(&sb, "  %s = %s >= %s ? 1 : -1;\n", decl_delta,
+                c_finish, c_i);
+    break;
+  case EXPR_RANGE_BOUNDED_LEFT:
+    sbuf_printf(&sb, "  %s = %s;\n", decl_i,
+                ee_type("int64", eval_expr(node_get_child(expr, 0))));
+    sbuf_printf(&sb, "  %s = INT64_MAX - 1;\n", decl_finish);
+    sbuf_printf(&sb, "  %s = 1;\n", decl_delta);
+    break;
+  default:
+    {
+      const char* c_range = mem_asprintf("_range%d", counter);
+      sbuf_printf(&sb, "  %s = %s;\n", gen_decl("Value", &c_range), ee->text);
+      sbuf_printf(&sb, "  %s = range_start(%s);\n", decl_i, c_range);
+      sbuf_printf(&sb, "  %s = range_finish(%s);\n", decl_finish, c_range);
+      sbuf_printf(&sb, "  %s = range_delta(%s);\n", decl_delta, c_range);
+    }
+  }
+
+  // The loop variable is kept unboxed unless the body assigns to it, or it
+  // is not a fresh Integer (or it would have to live in a generator frame).
+  const char* name = lvalue->type == ID ? lvalue->text
+                                        : node_get_string(lvalue, "name");
+  const char* type = "Integer";
+  if (lvalue->type == EXPR_TYPED_ID)
+    type = eval_type(node_get_node(lvalue, "type"));
+  bool unboxed = not var_query(name) and strequal(type, "Integer")
+                 and not node_assigns(block, name) and not in_frame();
+  const char* c_name = util_c_name(name);
+  const char* c_unboxed = util_unboxed_c_name(name);
+  if (unboxed){
+    sbuf_printf(&sb, "  Value %s;\n  int64 %s;\n", c_name, c_unboxed);
+    var_add_local2(name, c_name, type, VAR_UNBOXED);
+  }
+
+  // In "for i in a:x.size" over a fixed size array x, i is a valid index of x
+  // as long as the loop starts in range and ascends.  An Array1 may be
+  // resized by the body, so indexing it keeps one compare (see eval_index).
+  BoundsFact* fact = NULL;
+  Node* finish = expr->type == EXPR_RANGE_BOUNDED ? node_get_child(expr, 1)
+                                                  : NULL;
+  if (lang_optims & OPTIM_BOUNDS and unboxed and finish != NULL
+      and finish->type == EXPR_FIELD
+      and node_get_child(finish, 0)->type == ID){
+    const char* array = node_get_child(finish, 0)->text;
+    int dim;
+    const char* c_struct = NULL;
+    if (var_query(array) and not node_assigns(block, array))
+      c_struct = bounds_c_struct(var_query_type(array),
+                                 node_get_string(finish, "name"), &dim);
+    if (c_struct != NULL){
+      const char* type = var_query_type(array);
+      const char* v_array = eval_Value(node_get_child(finish, 0));
+      fact = mem_new(BoundsFact);
+      fact->index = name;
+      fact->array = array;
+      fact->dim = dim;
+      fact->c_inbounds = mem_asprintf("_inbounds%d", counter);
+      fact->c_data = mem_asprintf("_data%d", counter);
+      fact->block = context_block;
+      sbuf_printf(&sb, "  obj_verify(%s, %s);\n", v_array, cache_type(type));
+      sbuf_printf(&sb, "  %s* %s = obj_c_data(%s);\n", c_struct,
+                  fact->c_data, v_array);
+      sbuf_printf(&sb, "  const bool %s = %s >= 1 and %s >= %s;\n",
+                  fact->c_inbounds, c_i, c_finish, c_i);
+      sarray_append_ptr(&bounds_facts, fact);
+    }
+  }
+
+  const char* lbl_break = stacker_label();
+  const char* lbl_continue = stacker_label();
+  sbuf_printf(&sb, "  for(;; %s += %s){\n", c_i, c_delta);
+  if (unboxed){
+    sbuf_printf(&sb, "  %s = %s;\n  %s = int64_to_val(%s);\n", c_unboxed, c_i,
+                c_name, c_i);
+  } else {
+    sbuf_printf(&sb, "%s",
+                gen_assign_var(lvalue,
+                               ee_new("int64", c_i)));
+  }
+
+  stacker_push(STACKER_FOR, lbl_break, lbl_continue);
+  sbuf_printf(&sb, "%s", gen_block(block));
+  stacker_pop();
+  if (fact != NULL) sarray_pop(&bounds_facts);
+
+  sbuf_printf(&sb, " %s:;\n", lbl_continue);
+  sbuf_printf(&sb, "  if (%s == %s) break;\n", c_i, c_finish);
+  sbuf_printf(&sb, "  }\n");
+  sbuf_printf(&sb, " %s:;\n", lbl_break);
+  return sb.str;
+}
+
+// Binds a value to a single lvalue of a natively generated for loop.
+static const char* gen_for_bind(Node* lvalue, EE* value)
+{
+  if (lvalue->type == ID or lvalue->type == EXPR_TYPED_ID)
+    return gen_assign_var(lvalue, value);
+
+  static int counter = 0;
+  counter++;
+  Node* id_tmp = node_new_id(mem_asprintf("_for_tmp%d", counter));
+  return mem_asprintf("%s%s", gen_assign_var(id_tmp, value),
+                      gen_stmt_assign2(lvalue, id_tmp));
+}
+
+// For loops over an Array1, Tuple, Map or Set index directly into the
+// underlying C structure instead of going through an iterator object.  With
+// two lvalues, a Map binds the key and the value without building a Tuple.
+// Returns NULL if the loop cannot be optimized.
+static const char* gen_stmt_for_collection(Node* stmt, EE* ee)
+{
+  Node* lvalue_list = node_get_child(stmt, 0);
+  Node* block = node_get_child(stmt, 2);
+  const int num_lvalues = node_num_children(lvalue_list);
+  const bool is_array = strequal(ee->type, "Array1");
+  const bool is_tuple = strequal(ee->type, "Tuple");
+  const bool is_map = strequal(ee->type, "Map");
+  const bool is_set = strequal(ee->type, "Set");
+  if (not (is_array or is_tuple or is_map or is_set)) return NULL;
+
+  static int counter = 0;
+  counter++;
+  const char* c_coll = mem_asprintf("_coll%d", counter);
+  const char* c_k = mem_asprintf("_k%d", counter);
+
+  StringBuf sb;
+  sbuf_init(&sb, "");
+  EE* elem;
+  if (is_map or is_set){
+    const char* decl = gen_decl("HashTable*", &c_coll);
+    sbuf_printf(&sb, "  %s = val_to_%s(%s);\n", decl,
+                is_map ? "map" : "set", ee_Value(ee));
+    sbuf_printf(&sb, "  %s = 0;\n", gen_decl("uint64", &c_k));
+    sbuf_printf(&sb, "  for (; %s < %s->count; %s++){\n",
+                c_k, c_coll, c_k);
+    sbuf_printf(&sb, "  if (not ht_live(%s, %s)) continue;\n", c_coll, c_k);
+    elem = ee_new(UNTYPED, mem_asprintf("%s->keys[%s]", c_coll, c_k));
+  } else {
+    const char* decl = gen_decl(mem_asprintf("%s*", ee->type), &c_coll);
+    sbuf_printf(&sb, "  %s = val_to_%s(%s);\n", decl,
+                is_array ? "array1" : "tuple", ee_Value(ee));
+    // The size is reread on every iteration, as the body may push onto an
+    // Array1.
+    sbuf_printf(&sb, "  %s = 0;\n", gen_decl("uint64", &c_k));
+    sbuf_printf(&sb, "  for (; %s < (uint64) %s->size; %s++){\n",
+                c_k, c_coll, c_k);
+    elem = ee_new(UNTYPED, mem_asprintf("%s->data[%s]", c_coll, c_k));
+  }
+
+  if (is_map){
+    const char* c_value = mem_asprintf("%s->values[%s]", c_coll, c_k);
+    if (num_lvalues == 2){
+      sbuf_printf(&sb, "%s", gen_for_bind(node_get_child(lvalue_list, 0),
+                                          elem));
+      sbuf_printf(&sb, "%s", gen_for_bind(node_get_child(lvalue_list, 1),
+                                          ee_new(UNTYPED, c_value)));
+      elem = NULL;
+    } else {
+      elem = ee_new("Tuple", mem_asprintf("tuple_to_val(2, %s, %s)",
+                                          elem->text, c_value));
+    }
+  }
+  if (elem != NULL){
+    if (num_lvalues == 1){
+      sbuf_printf(&sb, "%s", gen_for_bind(node_get_child(lvalue_list, 0),
+                                          elem));
+    } else {
+      Node* id_tmp = node_new_id(mem_asprintf("_coll_elem%d", counter));
+      sbuf_printf(&sb, "%s", gen_assign_var(id_tmp, elem));
+      sbuf_printf(&sb, "%s", gen_stmt_assign(lvalue_list, id_tmp));
+    }
+  }
+
+  const char* lbl_break = stacker_label();
+  const char* lbl_continue = stacker_label();
+  stacker_push(STACKER_FOR, lbl_break, lbl_continue);
+  sbuf_printf(&sb, "%s", gen_block(block));
+  stacker_pop();
+
+  sbuf_printf(&sb, " %s:;\n", lbl_continue);
+  sbuf_printf(&sb, "  }\n");
+  sbuf_printf(&sb, " %s:;\n", lbl_break);
+  return sb.str;
+}
+
+// Stages of an Iterable chain that a for loop can fuse into its body.
+#define FUSE_MAP        1
+#define FUSE_FILTER     2
+#define FUSE_TAKE       3
+#define FUSE_ZIP        4
+#define FUSE_ENUMERATE  5
+
+typedef struct {
+  int kind;
+  Node* arg;        // Block (map, filter), count (take), iterable (zip)
+  const char* c_arg;
+  const char* c_count;
+} FuseStage;
+
+// If expr calls one of the lazy Iterable combinators, returns its name and
+// sets *iterable and *arg (NULL if it has no argument).  Both the
+// Iterable.map(x, f) and the x.map(f) forms are recognized, the latter only
+// if x is known to be a lazy iterator itself.
+static const char* fuse_call(Node* expr, Node** iterable, Node** arg)
+{
+  if (expr->type != EXPR_CALL) return NULL;
+  Node* callee = node_get_node(expr, "callee");
+  Node* args = node_get_node(expr, "args");
+  if (callee->type != EXPR_FIELD) return NULL;
+  const char* name = node_get_string(callee, "name");
+  Node* left = node_get_child(callee, 0);
+  int num_args = node_num_children(args);
+
+  Node* dummy;
+  if (left->type == ID and strequal(left->text, "Iterable")
+      and not var_query("Iterable")){
+    if (num_args < 1) return NULL;
+    *iterable = node_get_child(args, 0);
+    num_args--;
+  } else if (fuse_call(left, &dummy, &dummy) != NULL){
+    *iterable = left;
+  } else {
+    return NULL;
+  }
+  *arg = num_args == 1 ? node_get_child(args, node_num_children(args) - 1)
+                       : NULL;
+
+  if (strequal(name, "enumerate"))
+    return num_args == 0 ? name : NULL;
+  if (strequal(name, "map") or strequal(name, "filter")
+      or strequal(name, "take") or strequal(name, "zip")
+      or strequal(name, "chunk"))
+    return num_args == 1 ? name : NULL;
+  return NULL;
+}
+
+// For loops over a chain of Iterable.map, filter, take, zip and enumerate
+// pull from the source iterator directly and apply each stage inline, instead
+// of going through a Lazy object per stage.  Evaluation order matches the
+// lazy chain.  Returns NULL if the loop cannot be optimized.
+static const char* gen_stmt_for_fused(Node* stmt)
+{
+  Node* lvalue_list = node_get_child(stmt, 0);
+  Node* expr = node_get_child(stmt, 1);
+  Node* block = node_get_child(stmt, 2);
+  const int num_lvalues = node_num_children(lvalue_list);
+  if (stran_query_class("Iterable.Lazy") == NULL) return NULL;
+
+  // Collect the stages, outermost first.  A chunk stage is not fused, and
+  // becomes the source.
+  SArray stages;
+  sarray_init(&stages);
+  for (;;){
+    Node* iterable; Node* arg;
+    const char* name = fuse_call(expr, &iterable, &arg);
+    if (name == NULL or strequal(name, "chunk")) break;
+    FuseStage* stage = mem_new(FuseStage);
+    if (strequal(name, "map")) stage->kind = FUSE_MAP;
+    if (strequal(name, "filter")) stage->kind = FUSE_FILTER;
+    if (strequal(name, "take")) stage->kind = FUSE_TAKE;
+    if (strequal(name, "zip")) stage->kind = FUSE_ZIP;
+    if (strequal(name, "enumerate")) stage->kind = FUSE_ENUMERATE;
+    stage->arg = arg;
+    stage->c_arg = NULL;
+    stage->c_count = NULL;
+    sarray_append_ptr(&stages, stage);
+    expr = iterable;
+  }
+  if (stages.size == 0) return NULL;
+
+  static int counter = 0;
+  counter++;
+  StringBuf sb;
+  sbuf_init(&sb, "");
+
+  // Each Lazy.new evaluates its arguments, and then calls get_iter() on its
+  // iterables.
+  Node* id_source = node_new_id(mem_asprintf("_fuse_source%d", counter));
+  sbuf_printf(&sb, "%s", gen_assign_var(id_source, eval_expr(expr)));
+  for (int i = stages.size - 1; i >= 0; i--){
+    FuseStage* stage = sarray_get_ptr(&stages, i);
+    if (stage->kind == FUSE_ZIP){
+      Node* id_arg = node_new_id(mem_asprintf("_fuse_zip%d_%d", counter, i));
+      sbuf_printf(&sb, "%s", gen_assign_var(id_arg, eval_expr(stage->arg)));
+      stage->arg = id_arg;
+    } else if (stage->arg != NULL){
+      const char* c_arg = mem_asprintf("_fuse_arg%d_%d", counter, i);
+      const char* value;
+      if (stage->kind == FUSE_TAKE){
+        value = ee_type("int64", eval_expr(stage->arg));
+        sbuf_printf(&sb, "  %s = %s;\n", gen_decl("int64", &c_arg), value);
+      } else {
+        value = eval_Value(stage->arg);
+        sbuf_printf(&sb, "  %s = %s;\n", gen_decl("Value", &c_arg), value);
+      }
+      stage->c_arg = c_arg;
+    }
+    if (i == (int) stages.size - 1){
+      Node* call = node_new_field_call(id_source, "get_iter", 0);
+      sbuf_printf(&sb, "%s", gen_assign_var(id_source, eval_expr(call)));
+    }
+    if (stage->kind == FUSE_ZIP){
+      Node* call = node_new_field_call(stage->arg, "get_iter", 0);
+      sbuf_printf(&sb, "%s", gen_assign_var(stage->arg, eval_expr(call)));
+    }
+    if (stage->kind == FUSE_TAKE or stage->kind == FUSE_ENUMERATE){
+      const char* c_count = mem_asprintf("_fuse_count%d_%d", counter, i);
+      sbuf_printf(&sb, "  %s = 0;\n", gen_decl("int64", &c_count));
+      stage->c_count = c_count;
+    }
+  }
+
+  const char* lbl_break = stacker_label();
+  const char* lbl_continue = stacker_label();
+  sbuf_printf(&sb, "  for(;;){ %s:;\n", lbl_continue);
+  // A take that is done ends the loop before the source is pulled again.
+  for (uint i = 0; i < stages.size; i++){
+    FuseStage* stage = sarray_get_ptr(&stages, i);
+    if (stage->kind == FUSE_TAKE)
+      sbuf_printf(&sb, "  if (%s >= %s) break;\n", stage->c_count,
+                  stage->c_arg);
+  }
+  Node* id_elem = node_new_id(mem_asprintf("_fuse_elem%d", counter));
+  sbuf_printf(&sb, "%s", gen_assign_var(id_elem,
+                  eval_expr(node_new_field_call(id_source, "iter", 0))));
+  const char* c_elem = var_query_c_name(id_elem->text);
+  sbuf_printf(&sb, "  if (%s == VALUE_EOF) break;\n", c_elem);
+
+  // The outermost enumerate or zip binds two lvalues without a Tuple.
+  EE* first = NULL;
+  FuseStage* outer = sarray_get_ptr(&stages, 0);
+  const bool bind_pair = num_lvalues == 2 and (outer->kind == FUSE_ENUMERATE
+                                               or outer->kind == FUSE_ZIP);
+  for (int i = stages.size - 1; i >= 0; i--){
+    FuseStage* stage = sarray_get_ptr(&stages, i);
+    const char* c_value = NULL;
+    switch(stage->kind){
+    case FUSE_MAP:
+      sbuf_printf(&sb, "  %s = func_call1(%s, %s);\n", c_elem, stage->c_arg,
+                  c_elem);
+      break;
+    case FUSE_FILTER:
+      sbuf_printf(&sb, "  if (func_call1(%s, %s) != VALUE_TRUE) continue;\n",
+                  stage->c_arg, c_elem);
+      break;
+    case FUSE_TAKE:
+      sbuf_printf(&sb, "  %s++;\n", stage->c_count);
+      break;
+    case FUSE_ZIP:
+      c_value = mem_asprintf("_fuse_value%d_%d", counter, i);
+      sbuf_printf(&sb, "  %s = %s;\n", gen_decl("Value", &c_value),
+                  eval_Value(node_new_field_call(stage->arg, "iter", 0)));
+      sbuf_printf(&sb, "  if (%s == VALUE_EOF) break;\n", c_value);
+      if (i > 0 or not bind_pair){
+        sbuf_printf(&sb, "  %s = tuple_to_val(2, %s, %s);\n", c_elem, c_elem,
+                    c_value);
+      } else {
+        first = ee_new(UNTYPED, c_elem);
+        c_elem = c_value;
+      }
+      break;
+    case FUSE_ENUMERATE:
+      sbuf_printf(&sb, "  %s++;\n", stage->c_count);
+      if (i > 0 or not bind_pair){
+        sbuf_printf(&sb, "  %s = tuple_to_val(2, int64_to_val(%s), %s);\n",
+                    c_elem, stage->c_count, c_elem);
+      } else {
+        first = ee_new("int64", stage->c_count);
+      }
+      break;
+    }
+  }
+
+  if (first != NULL){
+    sbuf_printf(&sb, "%s", gen_for_bind(node_get_child(lvalue_list, 0),
+                                        first));
+    sbuf_printf(&sb, "%s", gen_for_bind(node_get_child(lvalue_list, 1),
+                                        ee_new(UNTYPED, c_elem)));
+  } else if (num_lvalues == 1){
+    sbuf_printf(&sb, "%s", gen_for_bind(node_get_child(lvalue_list, 0),
+                                        ee_new(UNTYPED, c_elem)));
+  } else {
+    sbuf_printf(&sb, "%s", gen_stmt_assign(lvalue_list, id_elem));
+  }
+
+  stacker_push(STACKER_FOR, lbl_break, lbl_continue);
+  sbuf_printf(&sb, "%s", gen_block(block));
+  stacker_pop();
+
+  sbuf_printf(&sb, "  }\n");
+  sbuf_printf(&sb, " %s:;\n", lbl_break);
+  return sb.str;
+}
+
+// If OPTIM_FOR_LOOPS, for loops over a Range, over a chain of lazy Iterable
+// combinators or over a builtin collection of a statically known type are
+// generated natively.  Returns NULL if the loop cannot be optimized, in which
+// case *evaluated is the already evaluated expression, or NULL.
+static const char* gen_stmt_for_native(Node* stmt, EE** evaluated)
+{
+  *evaluated = NULL;
+  Node* expr = node_get_child(stmt, 1);
+  if (not (lang_optims & OPTIM_FOR_LOOPS)) return NULL;
+  if (expr->type == EXPR_RANGE_BOUNDED or expr->type == EXPR_RANGE_BOUNDED_LEFT)
+    return gen_stmt_for_range(stmt, NULL);
+  const char* fused = gen_stmt_for_fused(stmt);
+  if (fused != NULL) return fused;
+
+  EE* ee = eval_expr(expr);
+  *evaluated = ee;
+  if (ee->type == NULL) return NULL;
+  if (strequal(ee->type, "Range")) return gen_stmt_for_range(stmt, ee);
+  return gen_stmt_for_collection(stmt, ee);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SWITCH
+///////////////////////////////////////////////////////////////////////////////
+
+// Kinds of case labels that can be dispatched on without op_equal.
+#define CASE_OTHER   0
+#define CASE_INT     1
+#define CASE_SYMBOL  2
+#define CASE_STRING  3
+
+static int switch_case_kind(Node* expr, int64* i)
+{
+  switch(expr->type){
+  case INT:
+    *i = strtoll(expr->text, NULL, 0);
+    return CASE_INT;
+  case CHARACTER:
+    *i = (int) expr->text[1];
+    return CASE_INT;
+  case SYMBOL:
+    return CASE_SYMBOL;
+  case STRING:
+    return CASE_STRING;
+  }
+  return CASE_OTHER;
+}
+
+// Switch statements dispatch on constant case labels before testing the
+// others in order.  Integer and character labels become a C switch, symbols
+// an integer comparison, and strings a lookup in a StringSwitch, built at
+// module init since the seed of string_hash is only known at run time.  The
+// first matching case still wins.
+static const char* gen_stmt_switch(Node* stmt)
+{
+  static int switch_counter = 0;
+  switch_counter++;
+  const char* c_expr_value = mem_asprintf("_switch_expr%d", switch_counter);
+  const char* c_case = mem_asprintf("_switch_case%d", switch_counter);
+  Node* expr = node_get_child(stmt, 0);
+  Node* case_list = node_get_child(stmt, 1);
+  const int num_cases = node_num_children(case_list);
+
+  StringBuf sb;
+  sbuf_init(&sb, "");
+  sbuf_printf(&sb, "  {\n");
+  const char* decl = gen_decl("Value", &c_expr_value);
+  sbuf_printf(&sb, "  %s = %s;\n", decl, eval_Value(expr));
+
+  // Sort the constant labels by kind.  Only the first of equal integer or
+  // string labels can match.
+  int kinds[num_cases + 1];
+  SArray ints, symbols, strings;
+  sarray_init(&ints);
+  sarray_init(&symbols);
+  sarray_init(&strings);
+  int num_constant = 0;
+  for (int i = 0; i < num_cases; i++){
+    Node* case_expr = node_get_child(node_get_child(case_list, i), 0);
+    int64 value;
+    kinds[i] = switch_case_kind(case_expr, &value);
+    if (kinds[i] != CASE_OTHER) num_constant++;
+    bool duplicate = false;
+    switch(kinds[i]){
+    case CASE_INT:
+      for (int j = 0; j < i; j++){
+        Node* other = node_get_child(node_get_child(case_list, j), 0);
+        int64 other_value;
+        if (kinds[j] == CASE_INT
+            and switch_case_kind(other, &other_value) == CASE_INT
+            and other_value == value) duplicate = true;
+      }
+      if (not duplicate) sarray_append_int(&ints, i);
+      break;
+    case CASE_SYMBOL:
+      sarray_append_int(&symbols, i);
+      break;
+    case CASE_STRING:
+      for (int j = 0; j < i; j++){
+        Node* other = node_get_child(node_get_child(case_list, j), 0);
+        if (kinds[j] == CASE_STRING and strequal(other->text, case_expr->text))
+          duplicate = true;
+      }
+      if (not duplicate) sarray_append_int(&strings, i);
+      break;
+    }
+  }
+
+  SArray string_exprs;
+  sarray_init(&string_exprs);
+  for (uint k = 0; k < strings.size; k++){
+    int i = sarray_get_int(&strings, k);
+    sarray_append_ptr(&string_exprs,
+                      node_get_child(node_get_child(case_list, i), 0));
+  }
+
+  if (num_constant > 0){
+    // c_case is the 1-based index of the first constant label that matches.
+    sbuf_printf(&sb, "  %s = 0;\n", gen_decl("int", &c_case));
+    if (ints.size > 0 or symbols.size > 0){
+      sbuf_printf(&sb, "  if (is_int64(%s)){\n", c_expr_value);
+      if (ints.size > 0){
+        sbuf_printf(&sb, "  switch(unpack_int64(%s)){\n", c_expr_value);
+        for (uint k = 0; k < ints.size; k++){
+          int i = sarray_get_int(&ints, k);
+          Node* case_expr = node_get_child(node_get_child(case_list, i), 0);
+          int64 value;
+          switch_case_kind(case_expr, &value);
+          sbuf_printf(&sb, "    case %"PRId64"LL: %s = %d; break;\n", value,
+                      c_case, i + 1);
+        }
+        sbuf_printf(&sb, "  }\n");
+      }
+      for (uint k = 0; k < symbols.size; k++){
+        int i = sarray_get_int(&symbols, k);
+        Node* case_expr = node_get_child(node_get_child(case_list, i), 0);
+        sbuf_printf(&sb, "  if ((%s == 0 or %s > %d) and %s == %s) %s = %d;\n",
+                    c_case, c_case, i + 1, c_expr_value,
+                    eval_Value(case_expr), c_case, i + 1);
+      }
+      sbuf_printf(&sb, "  }\n");
+    }
+    if (strings.size > 0){
+      // The labels are evaluated first, so that they are initialized before
+      // the table.
+      StringBuf labels;
+      sbuf_init(&labels, "");
+      for (uint k = 0; k < strings.size; k++){
+        Node* case_expr = sarray_get_ptr(&string_exprs, k);
+        sbuf_printf(&labels, k == 0 ? "%s" : ", %s", eval_Value(case_expr));
+      }
+      const char* c_switch = mem_asprintf("_string_switch%d", switch_counter);
+      wr_print(WR_HEADER, "static StringSwitch* %s;\n", c_switch);
+      wr_print(WR_INIT2, "  %s = string_switch_new(%d, (Value[]) {%s});\n",
+               c_switch, (int) strings.size, labels.str);
+
+      sbuf_printf(&sb, "  if (obj_klass(%s) == klass_String){\n",
+                  c_expr_value);
+      sbuf_printf(&sb, "  const int _k = string_switch_get(%s, %s);\n",
+                  c_switch, c_expr_value);
+      for (uint k = 0; k < strings.size; k++){
+        int i = sarray_get_int(&strings, k);
+        Node* case_expr = sarray_get_ptr(&string_exprs, k);
+        sbuf_printf(&sb, "  if ((_k == %d or _k < 0) and (%s == 0 or %s > %d)"
+                    " and op_equal2(%s, %s)) %s = %d;\n", k + 1, c_case,
+                    c_case, i + 1, c_expr_value, eval_Value(case_expr),
+                    c_case, i + 1);
+      }
+      sbuf_printf(&sb, "  }\n");
+    }
+  }
+
+  for (int i = 0; i < num_cases; i++){
+    Node* node_case = node_get_child(case_list, i);
+    Node* node_case_expr = node_get_child(node_case, 0);
+    Node* block = node_get_child(node_case, 1);
+    const char* word = "else if";
+    if (i == 0) word = "if";
+    if (kinds[i] == CASE_OTHER){
+      sbuf_printf(&sb, "  %s (op_equal(%s, %s) == VALUE_TRUE) {\n",
+                  word, c_expr_value, eval_Value(node_case_expr));
+    } else {
+      sbuf_printf(&sb, "  %s (%s == %d) {\n", word, c_case, i + 1);
+    }
+    sbuf_printf(&sb, "%s", gen_block(block));
+    sbuf_printf(&sb, "  }\n");
+  }
+  if (node_has_node(stmt, "else")){
+    sbuf_printf(&sb, "  else {\n");
+    sbuf_printf(&sb, "%s", gen_block(node_get_node(stmt, "else")));
+    sbuf_printf(&sb, "  }\n");
+  }
+  sbuf_printf(&sb, "  }\n");
+  return sb.str;
+}
+
 static const char* gen_stmt(Node* stmt)
 {
   StringBuf sb;
@@ -202,13 +949,36 @@ static const char* gen_stmt(Node* stmt)
     if (context_fi->type == CONSTRUCTOR){
       fatal_node(stmt, "return not allowed in a constructor");
     }
-    sbuf_printf(&sb, "  RRETURN(%s);\n",
-                eval_Value(node_get_child(stmt, 0)));
+    if (in_frame()){
+      // The frame is already marked as finished.
+      if (node_get_child(stmt, 0)->type != K_NIL)
+        fatal_node(stmt, "return with a value in a generator");
+      sbuf_printf(&sb, "  RRETURN(VALUE_EOF);\n");
+    } else if (context_block == NULL and util_has_unboxed(context_fi)
+               and util_unboxed_type(context_fi->ret) != NULL){
+      const char* type = util_unboxed_type(context_fi->ret);
+      sbuf_printf(&sb, "  { %s _rv = %s; stack_annot_pop(); return _rv; }\n",
+                  type, ee_type(type, eval_expr(node_get_child(stmt, 0))));
+    } else {
+      sbuf_printf(&sb, "  RRETURN(%s);\n",
+                  eval_Value(node_get_child(stmt, 0)));
+    }
     break;
   case STMT_DESTROY:
     sbuf_printf(&sb, "  obj_destroy(%s);\n",
                 eval_Value(node_get_child(stmt, 0)));
     break;
+  case STMT_YIELD:
+    if (not in_frame()) fatal_node(stmt, "yield inside a block");
+    if (stacker_in_try())
+      fatal_node(stmt, "yield inside try, catch or finally");
+    frame_yields++;
+    sbuf_printf(&sb, "  { Value _yv = %s;\n",
+                eval_Value(node_get_child(stmt, 0)));
+    sbuf_printf(&sb, "    _frame->_state = %d; RRETURN(_yv); }\n",
+                frame_yields);
+    sbuf_printf(&sb, " _yield%d:;\n", frame_yields);
+    break;
   case STMT_LOOP:
     {
       const char* lbl_break = stacker_label();
@@ -269,6 +1039,30 @@ static const char* gen_stmt(Node* stmt)
       // Outside scope begin
       var_push();
       sbuf_printf(&sb, "  {\n");
+
+      EE* evaluated;
+      const char* native_loop = gen_stmt_for_native(stmt, &evaluated);
+      if (native_loop != NULL){
+        sbuf_printf(&sb, "%s", native_loop);
+        sbuf_printf(&sb, "  }\n");
+        var_pop();
+        break;
+      }
+
+      // Don't generate expr twice if gen_stmt_for_native evaluated it.
+      if (evaluated != NULL){
+        const char* rip_expr = mem_asprintf("_for_expr%d", iterator_counter);
+        const char* c_expr = util_c_name(rip_expr);
+        sbuf_printf(&sb, "  %s = %s;\n", gen_decl("Value", &c_expr),
+                    ee_Value(evaluated));
+        // Unboxed C types were boxed above.
+        const char* type = evaluated->type;
+        if (type == NULL or strequal(type, "int64")
+            or strequal(type, "double") or strequal(type, "bool"))
+          type = "?";
+        var_add_local(rip_expr, c_expr, type);
+        expr = node_new_id(rip_expr);
+      }
       
       // _iteratorX = expr.get_iter()
       const char* rip_iterator = mem_asprintf("_iterator%d", iterator_counter);
@@ -308,34 +1102,7 @@ static const char* gen_stmt(Node* stmt)
     }
     break;
   case STMT_SWITCH:
-    {
-      static int switch_counter = 0;
-      const char* c_expr_value = mem_asprintf("_switch_expr%d", switch_counter);
-      Node* expr = node_get_child(stmt, 0);
-      Node* case_list = node_get_child(stmt, 1);
-
-      sbuf_printf(&sb, "  {\n");
-      sbuf_printf(&sb, "  Value %s = %s;\n", c_expr_value,
-                  eval_Value(expr));
-      int num_cases = node_num_children(case_list);
-      for (int i = 0; i < num_cases; i++){
-        Node* node_case = node_get_child(case_list, i);
-        Node* node_case_expr = node_get_child(node_case, 0);
-        Node* block = node_get_child(node_case, 1);
-        const char* word = "else if";
-        if (i == 0) word = "if";
-        sbuf_printf(&sb, "  %s (op_equal(%s, %s) == VALUE_TRUE) {\n",
-                    word, c_expr_value, eval_Value(node_case_expr));
-        sbuf_printf(&sb, "%s", gen_block(block));
-        sbuf_printf(&sb, "  }\n");
-      }
-      if (node_has_node(stmt, "else")){
-        sbuf_printf(&sb, "  else {\n");
-        sbuf_printf(&sb, "%s", gen_block(node_get_node(stmt, "else")));
-        sbuf_printf(&sb, "  }\n");
-      }
-      sbuf_printf(&sb, "  }\n");
-    }
+    sbuf_printf(&sb, "%s", gen_stmt_switch(stmt));
     break;
   case STMT_PASS:
     break;
@@ -359,27 +1126,33 @@ static const char* gen_try_stuff(Node* try_stmt, Node* other_stmt)
   StringBuf sb;
   sbuf_init(&sb, "");
 
+  static int handler_counter = 0;
+  handler_counter++;
+  const char* c_handler = mem_asprintf("_handler%d", handler_counter);
+  sbuf_printf(&sb, "  {\n");
+  sbuf_printf(&sb, "  ExcHandler %s;\n", c_handler);
+
   switch(other_stmt->type){
   case STMT_CATCH:
     //   try ...
-    sbuf_printf(&sb, "  if (setjmp(exc_jb) == 0){\n");
     if (node_has_node(other_stmt, "type")){
-      sbuf_printf(&sb, "    stack_push_catch(%s);\n",
+      sbuf_printf(&sb, "  exc_push(&%s, EXC_CATCH, %s);\n", c_handler,
                cache_type(
                  eval_type(
                    node_get_node(other_stmt, "type")
                  )
                ));
     } else {
-      sbuf_printf(&sb, "    stack_push_catch_all();\n");
+      sbuf_printf(&sb, "  exc_push(&%s, EXC_CATCH_ALL, NULL);\n", c_handler);
     }
+    sbuf_printf(&sb, "  if (exc_setjmp(%s.jb) == 0){\n", c_handler);
 
     // Generate try code
     stacker_push(STACKER_TRY, NULL, NULL);
     sbuf_printf(&sb, "%s", gen_block(node_get_node(try_stmt, "block")));
     stacker_pop();
     
-    sbuf_printf(&sb, "    stack_pop()\n;");
+    sbuf_printf(&sb, "    exc_pop(&%s);\n", c_handler);
 
     //   catch ...
     sbuf_printf(&sb, "  } else {\n");
@@ -403,12 +1176,12 @@ static const char* gen_try_stuff(Node* try_stmt, Node* other_stmt)
     sbuf_printf(&sb, "  }\n");
     break;
   case STMT_FINALLY:
-    sbuf_printf(&sb, "  if (setjmp(exc_jb) == 0){\n");
-    sbuf_printf(&sb, "    stack_push_finally();\n");
+    sbuf_printf(&sb, "  exc_push(&%s, EXC_FINALLY, NULL);\n", c_handler);
+    sbuf_printf(&sb, "  if (exc_setjmp(%s.jb) == 0){\n", c_handler);
     stacker_push(STACKER_TRY, NULL, NULL);
     sbuf_printf(&sb, "%s", gen_block(node_get_node(try_stmt, "block")));
     stacker_pop();
-    sbuf_printf(&sb, "    stack_pop()\n;");
+    sbuf_printf(&sb, "    exc_pop(&%s);\n", c_handler);
     sbuf_printf(&sb, "  }\n");
     stacker_push(STACKER_FINALLY, NULL, NULL);
     sbuf_printf(&sb, "%s", gen_block(node_get_node(other_stmt, "block")));
@@ -419,6 +1192,7 @@ static const char* gen_try_stuff(Node* try_stmt, Node* other_stmt)
   default:
     fatal_throw("invalid statement following try block");
   }
+  sbuf_printf(&sb, "  }\n");
   return sb.str;
 }
 
@@ -527,16 +1301,148 @@ const char* gen_block(Node* block)
 static void register_locals(const char* name)
 {
   FuncInfo* fi = stran_get_function(name); assert(fi != NULL);
+  bool unboxed = util_has_unboxed(fi);
 
   for (int i = 0; i < fi->num_params; i++){
     const char* var_type = fi->param_types[i];
     if (strequal(var_type, "*")) var_type = "Tuple";
-    var_add_local(fi->param_names[i],
-                  util_c_name(fi->param_names[i]),
-                  var_type);
+    const char* c_name = util_c_name(fi->param_names[i]);
+    const char* type = util_unboxed_type(var_type);
+    if (unboxed and type != NULL){
+      // Keep a boxed copy for C code, closures and assignments.
+      var_add_local2(fi->param_names[i], c_name, var_type, VAR_UNBOXED);
+      wr_print(WR_CODE, "  Value %s = %s_to_val(%s);\n", c_name, type,
+               util_unboxed_c_name(fi->param_names[i]));
+    } else {
+      var_add_local(fi->param_names[i], c_name, var_type);
+      bool is_self = (i == 0 and fi->type != FUNCTION
+                      and fi->type != CONSTRUCTOR);
+      if (not is_self and not strequal(fi->param_types[i], "*")){
+        EE* ee = ee_new(UNTYPED, c_name);
+        const char* verified = gen_typesafe(ee, var_type);
+        if (not strequal(verified, c_name))
+          wr_print(WR_CODE, "  %s = %s;\n", c_name, verified);
+      }
+    }
   }
 }
 
+// The boxed entry point of a function with an unboxed one unboxes its
+// arguments and forwards them.
+static void gen_boxed_wrapper(const char* name)
+{
+  FuncInfo* fi = stran_get_function(name); assert(fi != NULL);
+
+  StringBuf sb;
+  sbuf_init(&sb, "");
+  for (int i = 0; i < fi->num_params; i++){
+    const char* c_name = util_c_name(fi->param_names[i]);
+    const char* type = util_unboxed_type(fi->param_types[i]);
+    if (i != 0) sbuf_printf(&sb, ", ");
+    if (type == NULL) sbuf_printf(&sb, "%s", c_name);
+    else sbuf_printf(&sb, "val_to_%s(%s)", type, c_name);
+  }
+
+  const char* ret = util_unboxed_type(fi->ret);
+  wr_print(WR_CODE, "%s\n{\n", util_signature(name));
+  if (ret == NULL){
+    wr_print(WR_CODE, "  return unboxed_%s(%s);\n", fi->c_name, sb.str);
+  } else {
+    wr_print(WR_CODE, "  return %s_to_val(unboxed_%s(%s));\n", ret,
+             fi->c_name, sb.str);
+  }
+  wr_print(WR_CODE, "}\n");
+  sbuf_deinit(&sb);
+}
+
+// A generator function becomes two C functions.  The entry point verifies
+// the arguments, stores them in a new frame and returns a Generator.  The
+// resume function holds the body, with all locals in the frame; it jumps to
+// where the last yield left off, and returns VALUE_EOF once finished.
+static void gen_generator(Node* stmt_list, const char* name)
+{
+  FuncInfo* fi = context_fi;
+  if (fi->type != FUNCTION and fi->type != METHOD)
+    fatal_node(stmt_list, "yield outside of a function or method");
+  if (not strequal(fi->ret, "Generator"))
+    fatal_node(stmt_list, "generator declared to return '%s'", fi->ret);
+  const char* c_frame = mem_asprintf("%s_frame", fi->c_name);
+  const char* c_resume = mem_asprintf("%s_resume", fi->c_name);
+
+  Dict fields;
+  dict_init_string(&fields, sizeof(char*));
+  frame_fields = &fields;
+  frame_yields = 0;
+  stacker_init();
+  sarray_init(&bounds_facts);
+
+  StringBuf entry;
+  sbuf_init(&entry, "");
+  var_push();
+  for (int i = 0; i < fi->num_params; i++){
+    const char* type = fi->param_types[i];
+    if (strequal(type, "*")) type = "Tuple";
+    const char* c_name = util_c_name(fi->param_names[i]);
+    const char* field = c_name;
+    const char* decl = gen_decl("Value", &field);
+    if (i == 0 and fi->type == METHOD){
+      // self is reloaded from the frame on every resume.
+      var_add_local(fi->param_names[i], c_name, type);
+      sbuf_printf(&entry, "  %s = %s;\n", decl, c_name);
+      continue;
+    }
+    var_add_local(fi->param_names[i], field, type);
+    const char* value = c_name;
+    if (not strequal(fi->param_types[i], "*"))
+      value = gen_typesafe(ee_new(UNTYPED, c_name), type);
+    sbuf_printf(&entry, "  %s = %s;\n", decl, value);
+  }
+  const char* body = gen_block(stmt_list);
+  var_pop();
+  assert(stacker_size() == 0);
+  frame_fields = NULL;
+
+  // The frame
+  wr_print(WR_HEADER, "typedef struct {\n  int _state;\n");
+  DictIter* iter = dict_iter_new(&fields);
+  while (dict_iter_has(iter)){
+    char* c_name; char* c_type;
+    dict_iter_get_ptrs(iter, (void**) &c_name, (void**) &c_type);
+    wr_print(WR_HEADER, "  %s %s;\n", c_type, c_name);
+  }
+  wr_print(WR_HEADER, "} %s;\n", c_frame);
+
+  // The resume function
+  wr_print(WR_CODE, "static Value %s(void* _frame_v)\n{\n", c_resume);
+  wr_print(WR_CODE, "  %s* _frame = _frame_v;\n", c_frame);
+  if (fi->type == METHOD){
+    wr_print(WR_CODE, "  Value __self = _frame->__self;\n");
+    if (context_ci->type == CLASS_CDATA)
+      wr_print(WR_CODE, "  %s* _c_data = obj_c_data(__self);\n",
+               context_ci->typedef_name);
+  }
+  wr_print(WR_CODE, "  stack_annot_push(\"%s\");\n", name);
+  wr_print(WR_CODE, "  const int _state = _frame->_state;\n");
+  wr_print(WR_CODE, "  _frame->_state = -1;\n");
+  wr_print(WR_CODE, "  switch(_state){\n");
+  wr_print(WR_CODE, "    case 0: break;\n");
+  for (int i = 1; i <= frame_yields; i++)
+    wr_print(WR_CODE, "    case %d: goto _yield%d;\n", i, i);
+  wr_print(WR_CODE, "    default: RRETURN(VALUE_EOF);\n");
+  wr_print(WR_CODE, "  }\n");
+  wr_print(WR_CODE, "%s", body);
+  wr_print(WR_CODE, "  RRETURN(VALUE_EOF);\n}\n");
+
+  // The entry point
+  wr_print(WR_CODE, "%s\n{\n", util_signature(name));
+  wr_print(WR_CODE, "  stack_annot_push(\"%s\");\n", name);
+  wr_print(WR_CODE, "  %s* _frame = mem_calloc(sizeof(%s));\n", c_frame,
+           c_frame);
+  wr_print(WR_CODE, "%s", entry.str);
+  wr_print(WR_CODE, "  RRETURN(generator_to_val(%s, _frame));\n}\n",
+           c_resume);
+}
+
 // Generate all the statements, and maybe return VALUE_NIL at the end.
 static void gen_code(Node* n, const char* name)
 {
@@ -547,12 +1453,27 @@ static void gen_code(Node* n, const char* name)
 
   // Write prototype
   wr_print(WR_HEADER, "%s;\n", util_signature(name));
-  
+
+  Node* stmt_list = node_get_node(n, "stmt_list");
+  if (util_has_yield(stmt_list)){
+    gen_generator(stmt_list, name);
+    context_fi = NULL;
+    fatal_pop();
+    return;
+  }
+
   // Write code
-  wr_print(WR_CODE, "%s\n{\n", util_signature(name));
+  bool unboxed = util_has_unboxed(context_fi);
+  if (unboxed){
+    wr_print(WR_HEADER, "%s;\n", util_unboxed_signature(name));
+    gen_boxed_wrapper(name);
+    wr_print(WR_CODE, "%s\n{\n", util_unboxed_signature(name));
+  } else {
+    wr_print(WR_CODE, "%s\n{\n", util_signature(name));
+  }
   wr_print(WR_CODE, "  stack_annot_push(\"%s\");\n", name);
-  Node* stmt_list = node_get_node(n, "stmt_list");
   stacker_init();
+  sarray_init(&bounds_facts);
 
   var_push();
   register_locals(name);
@@ -587,8 +1508,13 @@ static void gen_code(Node* n, const char* name)
   if (context_fi->type != CONSTRUCTOR){
     if (stmt_list->children.size == 0
          or
-      node_get_child(stmt_list, stmt_list->children.size-1)->type != STMT_RETURN)
-    wr_print(WR_CODE, "  RRETURN(VALUE_NIL);\n");
+      node_get_child(stmt_list, stmt_list->children.size-1)->type != STMT_RETURN){
+      if (unboxed and util_unboxed_type(context_fi->ret) != NULL)
+        wr_print(WR_CODE, "  exc_raise(\"'%s' did not return a value\");\n",
+                 name);
+      else
+        wr_print(WR_CODE, "  RRETURN(VALUE_NIL);\n");
+    }
   } else {
     // If this is a constructor, remember to return the new object!
     wr_print(WR_CODE, "  RRETURN(__self);\n");
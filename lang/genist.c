@@ -51,13 +51,23 @@ static void add_parent(const char* child_name, const char* parent_name,
     ci->type = CLASS_FIELD;
   }
 
-  // Copy properties
+  // Copy properties.  The parent's properties keep their slots and the
+  // child's own are moved after them, so that code compiled against the
+  // parent's layout also works on the child.
   if (type_parent == CLASS_FIELD){
-    DictIter* iter = dict_iter_new(&(ci_parent->props));
+    DictIter* iter = dict_iter_new(&(ci->props));
     while (dict_iter_has(iter)){
       const char* prop_name; PropInfo* pi;
       dict_iter_get_ptrs(iter, (void**) &prop_name, (void**) &pi);
-      stran_add_class_property(child_name, prop_name);
+      pi->num += ci_parent->num_props;
+    }
+
+    iter = dict_iter_new(&(ci_parent->props));
+    while (dict_iter_has(iter)){
+      const char* prop_name; PropInfo* pi;
+      dict_iter_get_ptrs(iter, (void**) &prop_name, (void**) &pi);
+      PropInfo* pi_child = stran_add_class_property(child_name, prop_name);
+      pi_child->num = pi->num;
     }
   }
   
@@ -141,7 +141,7 @@ typedef struct {
 #define PROP_FIELD 1
 typedef struct {
   int type;
-  int num;
+  int num;                  // Slot in Object.values
 } PropInfo;
 
 typedef struct {
@@ -174,19 +174,23 @@ void stran_init(void);
 // Returns non-zero for error. (see stran_error.text)
 void stran_absorb_ast(Node* ast, const char* filename);
 void stran_absorb_file(const char* filename);
+// Infers return types of the functions absorbed from ASTs.  Call after all
+// ASTs and type files are absorbed.
+void stran_infer(void);
 
 void stran_dump_to_file(FILE* f);
 
 FuncInfo* stran_get_function(const char* name);
 GlobalInfo* stran_query_global(const char* name);
 GlobalInfo* stran_get_global(const char* name);
+ClassInfo* stran_query_class(const char* name);
 ClassInfo* stran_get_class(const char* name);
 FuncInfo* stran_get_method(const char* class_name, const char* name);
 
 void stran_add_function(const char* name, FuncInfo* fi);
 void stran_add_class_method(const char* class_name, const char* name, 
                             FuncInfo* fi, FunctionType type);
-void stran_add_class_property(const char* class_name, const char* name);
+PropInfo* stran_add_class_property(const char* class_name, const char* name);
 
 Dict* stran_get_classes(void); // Used by genist.
 
@@ -204,6 +208,9 @@ void cache_init(void);
 void cache_prototype(const char* ripe_name);
 const char* cache_dsym(const char* symbol);
 const char* cache_type(const char* type);
+const char* cache_ssym(const char* ssym);
+const char* cache_string(const char* text);
+const char* cache_method(const char* method);
 void cache_global_prototype(const char* global);
 
 //////////////////////////////////////////////////////////////////////////////
@@ -252,6 +259,7 @@ int input_read(char* buf, int max_size); // Used by flex to do reading
 #define STMT_PASS         1105
 #define STMT_ASSIGN       1106
 #define STMT_DESTROY      1107
+#define STMT_YIELD        1108
 
 #define STMT_BREAK        1111
 #define STMT_CONTINUE     1112
@@ -306,9 +314,11 @@ void tree_morph(Node* ast);
 //////////////////////////////////////////////////////////////////////////////
 
 // Data structure representing an evaluated expression (with an associated type)
+// Types "int64", "double" and "bool" mean that text is an unboxed C
+// expression of that type; anything else is a Value.
 #define UNTYPED   ((const char*) 1)
 typedef struct {
-  const char* type;  // If UNTYPED, then unknown type.
+  const char* type;  // If UNTYPED, then NULL.
   const char* text;  // Guaranteed non-NULL.
 } EE;
 EE* ee_new(const char* type, const char* text);
@@ -321,11 +331,12 @@ const char* ee_type(const char* type, EE* ee); // Evaluate ee as a particular
 EE* eval_expr(Node* expr);
 static inline const char* eval_Value(Node* expr)
 {
-  return eval_expr(expr)->text;
+  return ee_Value(eval_expr(expr));
 }
 
 const char* eval_type(Node* n);
 const char* eval_index(Node* self, Node* idx, Node* assign);
+const char* eval_field(Node* obj, const char* field, const char* assign);
 
 //////////////////////////////////////////////////////////////////////////////
 // lang/generator.c
@@ -347,6 +358,28 @@ typedef struct {
 } BlockContext;
 extern BlockContext* context_block;
 
+// Optimizations, set by the command line switches of riperipe.  All but
+// OPTIM_TYPE_VERIFY are on by default.
+#define OPTIM_FOR_LOOPS    1 // Native loops over ranges
+#define OPTIM_TYPES        2 // Static dispatch on receivers of known type
+#define OPTIM_FUNC_CALLS   4 // Direct C calls of static functions
+#define OPTIM_TYPE_VERIFY  8 // Do not verify assignments to typed variables
+#define OPTIM_BOUNDS      16 // Unchecked indexing in loops over array sizes
+extern int lang_optims;
+
+// While the body of "for i in a:x.size" (or x.size_x, x.size_y) is
+// generated, i is known to index dimension dim of the array variable x,
+// whenever c_inbounds holds.  c_data points to the C structure of x.
+typedef struct {
+  const char* index;
+  const char* array;
+  int dim;
+  const char* c_inbounds;
+  const char* c_data;
+  BlockContext* block;
+} BoundsFact;
+BoundsFact* bounds_query(const char* array, int dim, const char* index);
+
 // Uses fatal_* mechanism in case of error.
 void fatal_node(Node* node, const char* format, ...);
 const char* closure_add(const char* name, const char* evaluated);
@@ -357,11 +390,20 @@ void generate(Node* ast, const char* filename);
 // lang/operator.c
 //////////////////////////////////////////////////////////////////////////////
 
+// How an operator can be evaluated natively on statically typed operands:
+#define OPER_NEVER         0  // Always through the op_* function.
+#define OPER_NUMERIC       1  // int64, int64 => int64; with a double => double
+#define OPER_BOOL_NUMERIC  2  // Like OPER_NUMERIC, but the result is a bool
+#define OPER_INTEGER       3  // int64, int64 => int64
+#define OPER_BOOL_INTEGER  4  // int64, int64 => bool
+
 bool is_unary_op(Node* node);
 const char* unary_op_map(int type);
+int unary_op_native(int type, const char** c_op);
 
 bool is_binary_op(Node* node);
 const char* binary_op_map(int type);
+int binary_op_native(int type, const char** c_op);
 
 //////////////////////////////////////////////////////////////////////////////
 // lang/stacker.c
@@ -380,6 +422,8 @@ const char* stacker_break(int num);
 const char* stacker_continue(int num);
 void stacker_pop(void);
 int stacker_size(void);
+// True if inside a try, catch or finally block.
+bool stacker_in_try(void);
 
 //////////////////////////////////////////////////////////////////////////////
 // lang/util.c
@@ -388,6 +432,8 @@ int stacker_size(void);
 const char* util_escape(const char* ripe_name);
 const char* util_c_name(const char* ripe_name);
 const char* util_dot_id(Node* expr);
+// True if n yields (outside of blocks), i.e. n is the body of a generator.
+bool util_has_yield(Node* n);
 const char* util_trim_ends(const char* input);
 // In str, replace each character c by string replace
 const char* util_replace(const char* str, const char c, const char* replace);
@@ -396,6 +442,15 @@ const char* util_node_type(int type);
 // util_signature generates a string of the form:
 //   "Value __Module_Function(Value, Value, Value)
 const char* util_signature(const char* ripe_name);
+// Functions with Integer or Double parameters (or return value) also get an
+// unboxed entry point "unboxed_<c_name>" that takes and returns int64 and
+// double directly.  util_unboxed_type maps "Integer"/"Double" to the C type,
+// or returns NULL.
+const char* util_unboxed_type(const char* type);
+// Generator functions never do.
+bool util_has_unboxed(FuncInfo* fi);
+const char* util_unboxed_c_name(const char* ripe_name);
+const char* util_unboxed_signature(const char* ripe_name);
 bool annot_check_simple(Node* annot_list, int num, const char* args[]);
 bool annot_check(Node* annot_list, int num, ...);
 bool annot_has(Node* annot_list, const char* s);
@@ -419,6 +474,7 @@ int var_query_kind(const char* ripe_name);
 
 #define VAR_REGULAR     1
 #define VAR_BLOCK_PARAM 2
+#define VAR_UNBOXED     3 // Parameter also held unboxed in util_unboxed_c_name
 
 //////////////////////////////////////////////////////////////////////////////
 // lang/writer.c
@@ -18,29 +18,31 @@
 typedef struct {
   int type;
   const char* func;
+  int native;           // When operands are statically numeric (OPER_*)
+  const char* c_op;     // C operator used in that case
 } OperatorTable;
 
 static OperatorTable binary_ot[] =
 {
-  {'+',          "op_plus"},
-  {'-',          "op_minus"},
-  {'*',          "op_star"},
-  {'/',          "op_slash"},
-  {'^',          "op_exp"},
-  {K_AND,        "op_and"},
-  {K_OR,         "op_or"},
-  {K_IN,         "op_in"},
-  {K_BIT_AND,    "op_bit_and"},
-  {K_BIT_OR,     "op_bit_or"},
-  {K_BIT_XOR,    "op_bit_xor"},
-  {K_MODULO,     "op_modulo"},
-  {OP_EQUAL,     "op_equal"},
-  {OP_NOT_EQUAL, "op_not_equal"},
-  {'<',          "op_lt"},
-  {'>',          "op_gt"},
-  {OP_LTE,       "op_lte"},
-  {OP_GTE,       "op_gte"},
-  {0,            0}
+  {'+',          "op_plus",      OPER_NUMERIC,       "+"},
+  {'-',          "op_minus",     OPER_NUMERIC,       "-"},
+  {'*',          "op_star",      OPER_NUMERIC,       "*"},
+  {'/',          "op_slash",     OPER_NUMERIC,       "/"},
+  {'^',          "op_exp",       OPER_NEVER,         NULL},
+  {K_AND,        "op_and",       OPER_NEVER,         NULL},
+  {K_OR,         "op_or",        OPER_NEVER,         NULL},
+  {K_IN,         "op_in",        OPER_NEVER,         NULL},
+  {K_BIT_AND,    "op_bit_and",   OPER_INTEGER,       "&"},
+  {K_BIT_OR,     "op_bit_or",    OPER_INTEGER,       "|"},
+  {K_BIT_XOR,    "op_bit_xor",   OPER_INTEGER,       "^"},
+  {K_MODULO,     "op_modulo",    OPER_INTEGER,       "%"},
+  {OP_EQUAL,     "op_equal",     OPER_BOOL_INTEGER,  "=="},
+  {OP_NOT_EQUAL, "op_not_equal", OPER_BOOL_INTEGER,  "!="},
+  {'<',          "op_lt",        OPER_BOOL_NUMERIC,  "<"},
+  {'>',          "op_gt",        OPER_BOOL_NUMERIC,  ">"},
+  {OP_LTE,       "op_lte",       OPER_BOOL_NUMERIC,  "<="},
+  {OP_GTE,       "op_gte",       OPER_BOOL_NUMERIC,  ">="},
+  {0,            0,              0,                  0}
 };
 
 bool is_binary_op(Node* node)
@@ -63,12 +65,26 @@ const char* binary_op_map(int type){
   return NULL;
 }
 
+int binary_op_native(int type, const char** c_op)
+{
+  for (int i = 0; binary_ot[i].type != 0; i++){
+    if (type == binary_ot[i].type){
+      *c_op = binary_ot[i].c_op;
+      return binary_ot[i].native;
+    }
+  }
+  assert_never();
+
+  // Crash:
+  return OPER_NEVER;
+}
+
 static OperatorTable unary_ot[] =
 {
-  {'-',          "op_unary_minus"},
-  {K_NOT,        "op_unary_not"},
-  {K_BIT_NOT,    "op_unary_bit_not"},
-  {0,            0}
+  {'-',          "op_unary_minus",   OPER_NUMERIC,  "-"},
+  {K_NOT,        "op_unary_not",     OPER_NEVER,    NULL},
+  {K_BIT_NOT,    "op_unary_bit_not", OPER_INTEGER,  "~"},
+  {0,            0,                  0,             0}
 };
 
 bool is_unary_op(Node* node)
@@ -90,3 +106,17 @@ const char* unary_op_map(int type){
   // Crash:
   return NULL;
 }
+
+int unary_op_native(int type, const char** c_op)
+{
+  for (int i = 0; unary_ot[i].type != 0; i++){
+    if (type == unary_ot[i].type){
+      *c_op = unary_ot[i].c_op;
+      return unary_ot[i].native;
+    }
+  }
+  assert_never();
+
+  // Crash:
+  return OPER_NEVER;
+}
@@ -83,6 +83,7 @@
 %token   K_CATCH       "catch"
 %token   K_FINALLY     "finally"
 %token   K_RAISE       "raise"
+%token   K_YIELD       "yield"
 %token   K_FOR         "for"
 %token   K_IN          "in"
 %token   K_PASS        "pass"
@@ -205,7 +206,7 @@ func: ID '(' param_star ')' opt_annotation block
 func: type ID '(' param_star ')' opt_annotation block
                                { $$ = node_new(FUNCTION);
                                  node_set_node($$, "type", $1);
-                                 if ($5 != NULL)
+                                 if ($6 != NULL)
                                    node_set_node($$, "annotation", $6);
                                  node_set_string($$, "name", $2->text);
                                  node_set_node($$, "param_list", $4);
@@ -273,6 +274,8 @@ stmt:      "finally" block     { $$ = node_new(STMT_FINALLY);
                                  node_set_node($$, "block", $2); };
 stmt:      "raise" expr        { $$ = node_new(STMT_RAISE);
                                  node_add_child($$, $2); };
+stmt:      "yield" rvalue      { $$ = node_new(STMT_YIELD);
+                                 node_add_child($$, $2); };
 
 stmt:      "switch" expr START case_list END
                                { $$ = node_new(STMT_SWITCH);
@@ -28,6 +28,7 @@ static void make_func_value(const char* func_name)
   if (fi->num_params > 0 and strequal(fi->param_types[fi->num_params-1], "*")){
      wr_print(WR_INIT1B, "  func_set_vararg(%s);\n", fi->v_name);
   }
+  wr_print(WR_INIT1B, "  ssym_set(\"%s\", %s);\n", func_name, fi->v_name);
 }
 
 static void proc_function(Node* n, const char* name)
@@ -80,16 +81,22 @@ static void proc_class_exit(Node* n, const char* class_name)
   wr_print(WR_INIT1A, "  %s = klass_new(dsym_get(\"%s\"), %s);\n",
            ci->c_name, class_name, sz);
 
-  // Populate all the fields
+  // Populate all the fields, in slot order so that klass_new_field hands
+  // out the same numbers as PropInfo.num.
   if (ci->type == CLASS_FIELD) {
+    const char** prop_names = mem_malloc(ci->num_props * sizeof(char*));
     for (uint i = 0; i < ci->props.alloc_size; i++){
       if (dict_has_bucket(&(ci->props), i)){
         char* prop_name = *(char**) dict_get_bucket_key(&(ci->props), i);
         PropInfo* pi = *(PropInfo**) dict_get_bucket_value(&(ci->props), i);
-        wr_print(WR_INIT1B, "  klass_new_field(%s, dsym_get(\"%s\"), %s);\n",
-                 ci->c_name, prop_name, "FIELD_READABLE | FIELD_WRITABLE");
+        assert(pi->num >= 0 and pi->num < ci->num_props);
+        prop_names[pi->num] = prop_name;
       }
     }
+    for (int i = 0; i < ci->num_props; i++){
+      wr_print(WR_INIT1B, "  klass_new_field(%s, dsym_get(\"%s\"), %s);\n",
+               ci->c_name, prop_names[i], "FIELD_READABLE | FIELD_WRITABLE");
+    }
   }
   
   DictIter* iter;
@@ -121,12 +128,11 @@ static void proc_class_exit(Node* n, const char* class_name)
   
   // Set parent if any
   if (not strequal(ci->parent, "")){
-    // This MUST be in INIT2. That's the earliest where Klass* gets cached.'
-    // INIT3 is when globals get assigned. Exceptions may be thrown there, so
-    // at that time parents must be associated.
-    wr_print(WR_INIT2, "  %s->parent = %s;\n",
-             cache_type(class_name),
-             cache_type(ci->parent));
+    // This MUST be before phase 1.5, which flattens parents into the
+    // dispatch tables. All classes exist after INIT1A, so look up the parent
+    // directly rather than through the INIT2 type cache.
+    wr_print(WR_INIT1B, "  %s->parent = klass_get(dsym_get(\"%s\"));\n",
+             ci->c_name, ci->parent);
   }
 }
 
@@ -54,6 +54,16 @@ int stacker_size()
   return stacker.size;
 }
 
+bool stacker_in_try()
+{
+  for (uint i = 0; i < stacker.size; i++){
+    StackerElement* el = sarray_get_ptr(&stacker, i);
+    if (el->type == STACKER_TRY or el->type == STACKER_CATCH
+        or el->type == STACKER_FINALLY) return true;
+  }
+  return false;
+}
+
 static StackerElement* stacker_unwind(int num)
 {
   if (num < 1){
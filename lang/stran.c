@@ -19,6 +19,11 @@ Dict classes;
 Dict functions;
 Dict globals;
 Dict strings;
+// Names of the above absorbed from files, which stran_dump_to_file() leaves
+// out.
+static Dict loaded_classes;
+static Dict loaded_functions;
+static Dict loaded_globals;
 
 ///////////////////////////////////////////////////////////////////////
 // Static helper functions
@@ -73,8 +78,15 @@ static FuncInfo* func_info_params(Node* n, const char* class_name)
   Node* param_list = node_get_node(n, "param_list");
 
   FuncInfo* fi = mem_new(FuncInfo);
-  // TODO: fi->ret
-  fi->ret = stran_string("?");
+  // Explicit return type, otherwise stran_infer may find one.  Generator
+  // functions return a Generator.
+  if (node_has_node(n, "type")){
+    fi->ret = stran_string(util_dot_id(node_get_node(n, "type")));
+  } else if (util_has_yield(node_get_node(n, "stmt_list"))){
+    fi->ret = stran_string("Generator");
+  } else {
+    fi->ret = stran_string("?");
+  }
 
   // Populate parameters
   fi->num_params = node_num_children(param_list);
@@ -100,6 +112,13 @@ static FuncInfo* func_info_params(Node* n, const char* class_name)
   return fi;
 }
 
+// Functions whose return type is left to stran_infer.
+typedef struct {
+  FuncInfo* fi;
+  Node* n;
+} InferInfo;
+static Array infer_funcs;
+
 // Helper that combines functions and constructors
 static void helper_func(Node* n, const char* name, FunctionType type)
 {
@@ -109,6 +128,11 @@ static void helper_func(Node* n, const char* name, FunctionType type)
   fi->v_name = stran_string(mem_asprintf("rv_%s", util_escape(name)));
   fi->type = type;
   stran_add_function(name, fi);
+
+  if (type == FUNCTION and strequal(fi->ret, "?")){
+    InferInfo ii = { fi, n };
+    array_append(&infer_funcs, ii);
+  }
 }
 
 static void absorb_function(Node* n, const char* name)
@@ -241,6 +265,202 @@ void stran_absorb_ast(Node* ast, const char* filename)
   fatal_pop();
 }
 
+///////////////////////////////////////////////////////////////////////
+// return type inference
+///////////////////////////////////////////////////////////////////////
+
+// Types are joined in a lattice: NULL (not known yet) is below any type, and
+// "?" is above them.  Only Integer and Double are tracked, as those are what
+// the code generator can use.
+static const char* infer_join(const char* t1, const char* t2)
+{
+  if (t1 == NULL) return t2;
+  if (t2 == NULL) return t1;
+  if (strequal(t1, t2)) return t1;
+  return "?";
+}
+
+static Array infer_scopes; // Dict* for each nested STMT_LIST
+
+static const char* infer_var(const char* name)
+{
+  for (int i = infer_scopes.size - 1; i >= 0; i--){
+    Dict* scope = array_get(&infer_scopes, Dict*, i);
+    const char* type;
+    if (dict_query(scope, &name, &type)) return type;
+  }
+  return NULL;
+}
+
+static void infer_add_var(const char* name, const char* type)
+{
+  if (util_unboxed_type(type) == NULL) type = "?";
+  Dict* scope = array_get(&infer_scopes, Dict*, infer_scopes.size - 1);
+  dict_set(scope, &name, &type);
+}
+
+static void infer_push(void)
+{
+  Dict* scope = dict_new(sizeof(char*), sizeof(char*),
+                         dict_hash_string, dict_equal_string);
+  array_append(&infer_scopes, scope);
+}
+
+static void infer_pop(void)
+{
+  array_pop(&infer_scopes, Dict*);
+}
+
+// Static function called by callee, or NULL.  Functions absorbed from files
+// have their return types already.
+static FuncInfo* infer_callee(Node* callee)
+{
+  Node* first = callee;
+  while (first->type == EXPR_FIELD) first = node_get_child(first, 0);
+  if (first->type != ID or infer_var(first->text) != NULL) return NULL;
+
+  const char* name = util_dot_id(callee);
+  if (name == NULL) return NULL;
+  FuncInfo* fi = NULL;
+  dict_query(&functions, &name, &fi);
+  if (fi == NULL or fi->type != FUNCTION) return NULL;
+  return fi;
+}
+
+static const char* infer_expr(Node* expr)
+{
+  if (is_unary_op(expr) or is_binary_op(expr)){
+    const char* c_op;
+    int native;
+    const char* t1 = infer_expr(node_get_child(expr, 0));
+    const char* t2 = t1;
+    if (is_binary_op(expr)){
+      native = binary_op_native(expr->type, &c_op);
+      t2 = infer_expr(node_get_child(expr, 1));
+    } else {
+      native = unary_op_native(expr->type, &c_op);
+    }
+    if (native != OPER_NUMERIC and native != OPER_INTEGER) return "?";
+    if (t1 == NULL or t2 == NULL) return NULL;
+    if (util_unboxed_type(t1) == NULL or util_unboxed_type(t2) == NULL)
+      return "?";
+    if (strequal(t1, "Integer") and strequal(t2, "Integer")) return "Integer";
+    return native == OPER_NUMERIC ? "Double" : "?";
+  }
+
+  switch(expr->type){
+  case INT:
+  case CHARACTER:
+    return "Integer";
+  case DOUBLE:
+    return "Double";
+  case ID:
+    {
+      const char* type = infer_var(expr->text);
+      return type == NULL ? "?" : type;
+    }
+  case EXPR_CALL:
+    {
+      FuncInfo* fi = infer_callee(node_get_node(expr, "callee"));
+      if (fi == NULL) return "?";
+      if (fi->ret == NULL) return NULL;
+      return util_unboxed_type(fi->ret) == NULL ? "?" : fi->ret;
+    }
+  }
+  return "?";
+}
+
+// Walks statements in source order, tracking declared local variables, and
+// joins the types of all returned expressions into *ret.
+static void infer_node(Node* n, const char** ret)
+{
+  switch(n->type){
+  case EXPR_BLOCK:
+    // Returns inside a block return from the block.
+    return;
+  case STMT_LIST:
+    infer_push();
+    for (int i = 0; i < node_num_children(n); i++)
+      infer_node(node_get_child(n, i), ret);
+    infer_pop();
+    return;
+  case STMT_RETURN:
+    *ret = infer_join(*ret, infer_expr(node_get_child(n, 0)));
+    return;
+  case EXPR_TYPED_ID:
+    infer_add_var(node_get_string(n, "name"),
+                  util_dot_id(node_get_node(n, "type")));
+    return;
+  case STMT_ASSIGN:
+    {
+      Node* lvalues = node_get_child(n, 0);
+      for (int i = 0; i < node_num_children(lvalues); i++){
+        Node* lvalue = node_get_child(lvalues, i);
+        if (lvalue->type == ID and infer_var(lvalue->text) == NULL)
+          infer_add_var(lvalue->text, "?");
+      }
+    }
+    break;
+  }
+
+  for (int i = 0; i < node_num_children(n); i++)
+    infer_node(node_get_child(n, i), ret);
+  DictIter* iter = dict_iter_new(&(n->props_nodes));
+  while (dict_iter_has(iter)){
+    const char* key; Node* child;
+    dict_iter_get_ptrs(iter, (void**) &key, (void**) &child);
+    infer_node(child, ret);
+  }
+}
+
+static const char* infer_function(InferInfo* ii)
+{
+  Node* stmt_list = node_get_node(ii->n, "stmt_list");
+  int size = node_num_children(stmt_list);
+  // Falling off the end returns nil.
+  if (size == 0 or node_get_child(stmt_list, size - 1)->type != STMT_RETURN)
+    return "?";
+
+  infer_push();
+  for (int i = 0; i < ii->fi->num_params; i++)
+    infer_add_var(ii->fi->param_names[i], ii->fi->param_types[i]);
+  const char* ret = NULL;
+  infer_node(stmt_list, &ret);
+  infer_pop();
+  return ret;
+}
+
+void stran_infer()
+{
+  fatal_push("during return type inference");
+
+  // Start from "not known yet" and iterate to a fixpoint, so that recursive
+  // and mutually recursive functions get a type.
+  for (uint i = 0; i < infer_funcs.size; i++)
+    array_get(&infer_funcs, InferInfo, i).fi->ret = NULL;
+
+  bool changed = true;
+  while (changed){
+    changed = false;
+    for (uint i = 0; i < infer_funcs.size; i++){
+      InferInfo* ii = &array_get(&infer_funcs, InferInfo, i);
+      const char* ret = infer_function(ii);
+      if (ret != ii->fi->ret and (ret == NULL or ii->fi->ret == NULL
+                                  or not strequal(ret, ii->fi->ret))){
+        ii->fi->ret = ret;
+        changed = true;
+      }
+    }
+  }
+
+  for (uint i = 0; i < infer_funcs.size; i++){
+    FuncInfo* fi = array_get(&infer_funcs, InferInfo, i).fi;
+    fi->ret = stran_string(fi->ret == NULL ? "?" : fi->ret);
+  }
+  array_clear(&infer_funcs);
+  fatal_pop();
+}
+
 ///////////////////////////////////////////////////////////////////////
 // stran dumping to and loading from disk
 ///////////////////////////////////////////////////////////////////////
@@ -276,12 +496,13 @@ static void absorb_methods(FILE* f, Dict* methods)
 void stran_dump_to_file(FILE* f)
 {
   // Encode functions
-  encode_int(f, functions.size);
+  encode_int(f, functions.size - loaded_functions.size);
   
   DictIter* iter_functions = dict_iter_new(&functions);
   while (dict_iter_has(iter_functions)){
     char* func_name; FuncInfo* fi;
     dict_iter_get_ptrs(iter_functions, (void**) &func_name, (void**) &fi);
+    if (dict_query(&loaded_functions, &func_name, NULL)) continue;
     
     encode_string(f, func_name);
     encode_string(f, fi->c_name);
@@ -296,12 +517,13 @@ void stran_dump_to_file(FILE* f)
   }
   
   // Encode classes
-  encode_int(f, classes.size);
+  encode_int(f, classes.size - loaded_classes.size);
 
   DictIter* iter_classes = dict_iter_new(&classes);
   while (dict_iter_has(iter_classes)){
     char* class_name; ClassInfo* ci;
     dict_iter_get_ptrs(iter_classes, (void**) &class_name, (void**) &ci);
+    if (dict_query(&loaded_classes, &class_name, NULL)) continue;
      
     encode_string(f, class_name);
     encode_string(f, ci->parent);
@@ -321,6 +543,7 @@ void stran_dump_to_file(FILE* f)
       
       encode_string(f, prop_name);
       encode_int(f, pi->type);
+      encode_int(f, pi->num);
     }
     
     encode_int(f, ci->mixins.size);
@@ -332,11 +555,12 @@ void stran_dump_to_file(FILE* f)
   }
   
   // Encode globals
-  encode_int(f, globals.size);
+  encode_int(f, globals.size - loaded_globals.size);
   DictIter* iter_globals = dict_iter_new(&globals);
   while (dict_iter_has(iter_globals)){
     char* global_name; GlobalInfo* gi;
     dict_iter_get_ptrs(iter_globals, (void**) &global_name, (void**) &gi);
+    if (dict_query(&loaded_globals, &global_name, NULL)) continue;
 
     encode_string(f, global_name);
     encode_string(f, gi->c_name);
@@ -358,6 +582,7 @@ void stran_absorb_file(const char* filename)
     FuncInfo* fi = mem_new(FuncInfo);
     const char* func_name = decode_string(f);
     
+    fi->ripe_name = func_name;
     fi->c_name = decode_string(f);
     fi->v_name = decode_string(f);
     fi->ret = decode_string(f);
@@ -370,6 +595,7 @@ void stran_absorb_file(const char* filename)
       fi->param_names[j] = decode_string(f);
     }
     stran_add_function(func_name, fi);
+    dict_set(&loaded_functions, &func_name, &fi);
   }
   
   // Decode classes
@@ -383,6 +609,7 @@ void stran_absorb_file(const char* filename)
     ci->type = decode_int(f);
     ci->typedef_name = decode_string(f);
     dict_set(&(classes), &class_name, &ci);
+    dict_set(&loaded_classes, &class_name, &ci);
   
     absorb_methods(f, &(ci->methods));
     absorb_methods(f, &(ci->vg_methods));
@@ -392,7 +619,9 @@ void stran_absorb_file(const char* filename)
     for (int j = 0; j < num_props; j++){
       const char* prop_name = decode_string(f);
       int type = decode_int(f); // Ignored for now
-      stran_add_class_property(class_name, prop_name);
+      int num = decode_int(f);
+      PropInfo* pi = stran_add_class_property(class_name, prop_name);
+      pi->num = num;
     }
     
     int64 num_mixins = decode_int(f);
@@ -409,6 +638,7 @@ void stran_absorb_file(const char* filename)
     const char* global_name = decode_string(f);
     gi->c_name = decode_string(f);
     dict_set(&globals, &global_name, &gi);
+    dict_set(&loaded_globals, &global_name, &gi);
   }
   
   fatal_pop();
@@ -458,6 +688,13 @@ GlobalInfo* stran_get_global(const char* name)
   return gi;
 }
 
+ClassInfo* stran_query_class(const char* name)
+{
+  ClassInfo* ci = NULL;
+  dict_query(&(classes), &name, &ci);
+  return ci;
+}
+
 ClassInfo* stran_get_class(const char* name)
 {
   ClassInfo* ci = NULL;
@@ -503,7 +740,9 @@ void stran_add_class_method(const char* class_name, const char* name,
   }
 }
 
-void stran_add_class_property(const char* class_name, const char* name)
+// Properties are numbered in the order they are added, which is also their
+// slot in the object (see proc.c and genist.c).
+PropInfo* stran_add_class_property(const char* class_name, const char* name)
 {
   ClassInfo* ci = stran_get_class(class_name);
   
@@ -513,8 +752,10 @@ void stran_add_class_property(const char* class_name, const char* name)
 
   PropInfo* pi = mem_new(PropInfo);
   pi->type = PROP_FIELD;
+  pi->num = ci->num_props;
   dict_set(&(ci->props), &name, &pi);
   ci->num_props += 1;
+  return pi;
 }
 
 Dict* stran_get_classes()
@@ -528,4 +769,9 @@ void stran_init()
   dict_init_string(&(functions), sizeof(FuncInfo*));
   dict_init_string(&(globals), sizeof(GlobalInfo*));
   dict_init_string(&(strings), sizeof(char*));
+  array_init(&infer_funcs, InferInfo);
+  dict_init_string(&loaded_classes, sizeof(ClassInfo*));
+  dict_init_string(&loaded_functions, sizeof(FuncInfo*));
+  dict_init_string(&loaded_globals, sizeof(GlobalInfo*));
+  array_init(&infer_scopes, Dict*);
 }
@@ -90,6 +90,22 @@ const char* util_dot_id(Node* expr)
   }
 }
 
+bool util_has_yield(Node* n)
+{
+  if (n->type == STMT_YIELD) return true;
+  if (n->type == EXPR_BLOCK) return false;
+  for (int i = 0; i < node_num_children(n); i++){
+    if (util_has_yield(node_get_child(n, i))) return true;
+  }
+  DictIter* iter = dict_iter_new(&(n->props_nodes));
+  while (dict_iter_has(iter)){
+    const char* key; Node* child;
+    dict_iter_get_ptrs(iter, (void**) &key, (void**) &child);
+    if (util_has_yield(child)) return true;
+  }
+  return false;
+}
+
 const char* util_signature(const char* ripe_name)
 {
   FuncInfo* fi = stran_get_function(ripe_name);
@@ -116,6 +132,59 @@ const char* util_signature(const char* ripe_name)
   return rv;
 }
 
+const char* util_unboxed_type(const char* type)
+{
+  if (type == NULL) return NULL;
+  if (strequal(type, "Integer")) return "int64";
+  if (strequal(type, "Double")) return "double";
+  return NULL;
+}
+
+bool util_has_unboxed(FuncInfo* fi)
+{
+  if (fi->type != FUNCTION or strequal(fi->ret, "Generator")) return false;
+  bool unboxed = util_unboxed_type(fi->ret) != NULL;
+  for (int i = 0; i < fi->num_params; i++){
+    if (strequal(fi->param_types[i], "*")) return false;
+    if (util_unboxed_type(fi->param_types[i]) != NULL) unboxed = true;
+  }
+  return unboxed;
+}
+
+const char* util_unboxed_c_name(const char* ripe_name)
+{
+  return mem_asprintf("_u%s", util_c_name(ripe_name));
+}
+
+const char* util_unboxed_signature(const char* ripe_name)
+{
+  FuncInfo* fi = stran_get_function(ripe_name);
+  assert(fi != NULL and util_has_unboxed(fi));
+
+  const char* ret = util_unboxed_type(fi->ret);
+  StringBuf sb;
+  sbuf_init(&sb, "");
+  sbuf_printf(&sb, "%s unboxed_%s(", ret == NULL ? "Value" : ret, fi->c_name);
+
+  if (fi->num_params == 0) sbuf_printf(&sb, "void");
+  for (int i = 0; i < fi->num_params; i++){
+    const char* type = util_unboxed_type(fi->param_types[i]);
+    if (type == NULL){
+      sbuf_printf(&sb, "Value %s", util_c_name(fi->param_names[i]));
+    } else {
+      sbuf_printf(&sb, "%s %s", type,
+                  util_unboxed_c_name(fi->param_names[i]));
+    }
+    if (i != fi->num_params - 1){
+      sbuf_printf(&sb, ", ");
+    }
+  }
+  sbuf_printf(&sb, ")");
+  const char* rv = mem_strdup(sb.str);
+  sbuf_deinit(&sb);
+  return rv;
+}
+
 bool annot_check_simple(Node* annot_list, int num, const char* args[])
 {
   assert(annot_list != NULL);
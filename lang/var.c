@@ -89,6 +89,7 @@ static Variable* query(const char* ripe_name)
   var->ripe_name = ripe_name;
   var->c_name = gi->c_name;
   var->type = "?"; // TODO
+  var->kind = VAR_REGULAR;
   return var;
 }
 
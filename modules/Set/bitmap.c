@@ -0,0 +1,498 @@
+#include "bitmap.h"
+
+// Whole-bitmap operations are written as plain loops over words, which
+// compilers vectorize, with a popcount per word.
+
+static inline int64 words_and(uint64* out, const uint64* a, const uint64* b)
+{
+  int64 card = 0;
+  for (int i = 0; i < BM_WORDS; i++){
+    out[i] = a[i] & b[i];
+    card += __builtin_popcountll(out[i]);
+  }
+  return card;
+}
+
+static inline int64 words_or(uint64* out, const uint64* a, const uint64* b)
+{
+  int64 card = 0;
+  for (int i = 0; i < BM_WORDS; i++){
+    out[i] = a[i] | b[i];
+    card += __builtin_popcountll(out[i]);
+  }
+  return card;
+}
+
+static inline int64 words_andnot(uint64* out, const uint64* a,
+                                 const uint64* b)
+{
+  int64 card = 0;
+  for (int i = 0; i < BM_WORDS; i++){
+    out[i] = a[i] & ~b[i];
+    card += __builtin_popcountll(out[i]);
+  }
+  return card;
+}
+
+static inline int64 words_and_card(const uint64* a, const uint64* b)
+{
+  int64 card = 0;
+  for (int i = 0; i < BM_WORDS; i++){
+    card += __builtin_popcountll(a[i] & b[i]);
+  }
+  return card;
+}
+
+static inline bool bit_get(const uint64* bits, uint16 v)
+{
+  return (bits[v >> 6] >> (v & 63)) & 1;
+}
+
+// Index of v in a sorted array, or -(insertion point) - 1.
+static int64 array_search(const uint16* a, int64 n, uint16 v)
+{
+  int64 lo = 0, hi = n - 1;
+  while (lo <= hi){
+    const int64 mid = (lo + hi) / 2;
+    if (a[mid] < v) lo = mid + 1;
+    else if (a[mid] > v) hi = mid - 1;
+    else return mid;
+  }
+  return -lo - 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Containers
+//////////////////////////////////////////////////////////////////////////////
+
+static void bc_init_array(BmContainer* c, uint64 key, int64 alloc)
+{
+  c->key = key;
+  c->card = 0;
+  c->alloc = alloc;
+  c->array = mem_malloc_atomic(alloc * sizeof(uint16));
+  c->bits = NULL;
+}
+
+static void bc_init_bits(BmContainer* c, uint64 key)
+{
+  c->key = key;
+  c->card = 0;
+  c->alloc = 0;
+  c->array = NULL;
+  c->bits = mem_calloc_atomic(BM_WORDS * sizeof(uint64));
+}
+
+static void bc_to_bits(BmContainer* c)
+{
+  uint64* bits = mem_calloc_atomic(BM_WORDS * sizeof(uint64));
+  for (int64 i = 0; i < c->card; i++){
+    bits[c->array[i] >> 6] |= 1ULL << (c->array[i] & 63);
+  }
+  mem_free(c->array);
+  c->array = NULL;
+  c->alloc = 0;
+  c->bits = bits;
+}
+
+static void bc_to_array(BmContainer* c)
+{
+  uint64* bits = c->bits;
+  c->alloc = c->card > 4 ? c->card : 4;
+  c->array = mem_malloc_atomic(c->alloc * sizeof(uint16));
+  int64 n = 0;
+  for (int i = 0; i < BM_WORDS; i++){
+    uint64 w = bits[i];
+    while (w != 0){
+      c->array[n++] = i * 64 + __builtin_ctzll(w);
+      w &= w - 1;
+    }
+  }
+  mem_free(bits);
+  c->bits = NULL;
+}
+
+// Picks the representation for the cardinality.
+static void bc_fit(BmContainer* c)
+{
+  if (c->bits != NULL and c->card <= BM_ARRAY_MAX) bc_to_array(c);
+}
+
+static void bc_push(BmContainer* c, uint16 v)
+{
+  if (c->card == c->alloc){
+    c->alloc *= 2;
+    c->array = mem_realloc(c->array, c->alloc * sizeof(uint16));
+  }
+  c->array[c->card++] = v;
+}
+
+static void bc_copy(BmContainer* out, BmContainer* c)
+{
+  *out = *c;
+  if (c->bits != NULL){
+    out->bits = mem_malloc_atomic(BM_WORDS * sizeof(uint64));
+    memcpy(out->bits, c->bits, BM_WORDS * sizeof(uint64));
+  } else {
+    out->array = mem_malloc_atomic(c->alloc * sizeof(uint16));
+    memcpy(out->array, c->array, c->card * sizeof(uint16));
+  }
+}
+
+static bool bc_contains(BmContainer* c, uint16 v)
+{
+  if (c->bits != NULL) return bit_get(c->bits, v);
+  return array_search(c->array, c->card, v) >= 0;
+}
+
+static bool bc_add(BmContainer* c, uint16 v)
+{
+  if (c->bits != NULL){
+    if (bit_get(c->bits, v)) return false;
+    c->bits[v >> 6] |= 1ULL << (v & 63);
+    c->card++;
+    return true;
+  }
+  int64 idx = array_search(c->array, c->card, v);
+  if (idx >= 0) return false;
+  if (c->card == BM_ARRAY_MAX){
+    bc_to_bits(c);
+    return bc_add(c, v);
+  }
+  idx = -idx - 1;
+  bc_push(c, v);
+  memmove(c->array + idx + 1, c->array + idx,
+          (c->card - 1 - idx) * sizeof(uint16));
+  c->array[idx] = v;
+  return true;
+}
+
+static bool bc_remove(BmContainer* c, uint16 v)
+{
+  if (c->bits != NULL){
+    if (not bit_get(c->bits, v)) return false;
+    c->bits[v >> 6] &= ~(1ULL << (v & 63));
+    c->card--;
+    bc_fit(c);
+    return true;
+  }
+  const int64 idx = array_search(c->array, c->card, v);
+  if (idx < 0) return false;
+  memmove(c->array + idx, c->array + idx + 1,
+          (c->card - 1 - idx) * sizeof(uint16));
+  c->card--;
+  return true;
+}
+
+static void bc_and(BmContainer* out, BmContainer* a, BmContainer* b)
+{
+  if (a->bits != NULL and b->bits != NULL){
+    bc_init_bits(out, a->key);
+    out->card = words_and(out->bits, a->bits, b->bits);
+    bc_fit(out);
+    return;
+  }
+  if (a->bits != NULL){
+    BmContainer* tmp = a;
+    a = b;
+    b = tmp;
+  }
+  // a is an array.
+  bc_init_array(out, a->key, a->card > 4 ? a->card : 4);
+  if (b->bits != NULL){
+    for (int64 i = 0; i < a->card; i++){
+      if (bit_get(b->bits, a->array[i])) out->array[out->card++] = a->array[i];
+    }
+    return;
+  }
+  int64 i = 0, j = 0;
+  while (i < a->card and j < b->card){
+    if (a->array[i] < b->array[j]) i++;
+    else if (a->array[i] > b->array[j]) j++;
+    else {
+      out->array[out->card++] = a->array[i];
+      i++;
+      j++;
+    }
+  }
+}
+
+static int64 bc_and_card(BmContainer* a, BmContainer* b)
+{
+  if (a->bits != NULL and b->bits != NULL)
+    return words_and_card(a->bits, b->bits);
+  if (a->bits != NULL){
+    BmContainer* tmp = a;
+    a = b;
+    b = tmp;
+  }
+  int64 card = 0;
+  if (b->bits != NULL){
+    for (int64 i = 0; i < a->card; i++){
+      card += bit_get(b->bits, a->array[i]);
+    }
+    return card;
+  }
+  int64 i = 0, j = 0;
+  while (i < a->card and j < b->card){
+    if (a->array[i] < b->array[j]) i++;
+    else if (a->array[i] > b->array[j]) j++;
+    else {
+      card++;
+      i++;
+      j++;
+    }
+  }
+  return card;
+}
+
+static void bc_or(BmContainer* out, BmContainer* a, BmContainer* b)
+{
+  if (a->bits == NULL and b->bits == NULL
+       and a->card + b->card <= BM_ARRAY_MAX){
+    bc_init_array(out, a->key, a->card + b->card > 4 ? a->card + b->card : 4);
+    int64 i = 0, j = 0;
+    while (i < a->card or j < b->card){
+      if (j == b->card or (i < a->card and a->array[i] < b->array[j])){
+        out->array[out->card++] = a->array[i++];
+      } else if (i == a->card or b->array[j] < a->array[i]){
+        out->array[out->card++] = b->array[j++];
+      } else {
+        out->array[out->card++] = a->array[i++];
+        j++;
+      }
+    }
+    return;
+  }
+  if (a->bits != NULL and b->bits != NULL){
+    bc_init_bits(out, a->key);
+    out->card = words_or(out->bits, a->bits, b->bits);
+    return;
+  }
+  if (a->bits == NULL){
+    BmContainer* tmp = a;
+    a = b;
+    b = tmp;
+  }
+  // Start from a, and add the elements of b, which is an array.
+  if (a->bits == NULL){
+    bc_copy(out, a);
+    bc_to_bits(out);
+  } else {
+    bc_copy(out, a);
+  }
+  for (int64 i = 0; i < b->card; i++){
+    const uint16 v = b->array[i];
+    out->card += not bit_get(out->bits, v);
+    out->bits[v >> 6] |= 1ULL << (v & 63);
+  }
+  bc_fit(out);
+}
+
+static void bc_andnot(BmContainer* out, BmContainer* a, BmContainer* b)
+{
+  if (a->bits == NULL){
+    bc_init_array(out, a->key, a->card > 4 ? a->card : 4);
+    for (int64 i = 0; i < a->card; i++){
+      if (not bc_contains(b, a->array[i]))
+        out->array[out->card++] = a->array[i];
+    }
+    return;
+  }
+  if (b->bits != NULL){
+    bc_init_bits(out, a->key);
+    out->card = words_andnot(out->bits, a->bits, b->bits);
+  } else {
+    bc_copy(out, a);
+    for (int64 i = 0; i < b->card; i++){
+      const uint16 v = b->array[i];
+      out->card -= bit_get(out->bits, v);
+      out->bits[v >> 6] &= ~(1ULL << (v & 63));
+    }
+  }
+  bc_fit(out);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// Bitmaps
+//////////////////////////////////////////////////////////////////////////////
+
+void bitmap_init(Bitmap* b)
+{
+  b->size = 0;
+  b->alloc = 4;
+  b->cs = mem_malloc(b->alloc * sizeof(BmContainer));
+}
+
+// Index of the container for key, or -(insertion point) - 1.
+static int64 bm_find(Bitmap* b, uint64 key)
+{
+  int64 lo = 0, hi = b->size - 1;
+  while (lo <= hi){
+    const int64 mid = (lo + hi) / 2;
+    if (b->cs[mid].key < key) lo = mid + 1;
+    else if (b->cs[mid].key > key) hi = mid - 1;
+    else return mid;
+  }
+  return -lo - 1;
+}
+
+// Makes room for a container at idx, and returns it.
+static BmContainer* bm_insert(Bitmap* b, int64 idx)
+{
+  if (b->size == b->alloc){
+    b->alloc *= 2;
+    b->cs = mem_realloc(b->cs, b->alloc * sizeof(BmContainer));
+  }
+  memmove(b->cs + idx + 1, b->cs + idx, (b->size - idx) * sizeof(BmContainer));
+  b->size++;
+  return &(b->cs[idx]);
+}
+
+// Appends c, if it isn't empty.
+static void bm_append(Bitmap* b, BmContainer* c)
+{
+  if (c->card == 0) return;
+  *bm_insert(b, b->size) = *c;
+}
+
+static inline void bm_check(int64 x)
+{
+  if (x < 0) exc_raise("BitmapSet can't hold negative %"PRId64, x);
+}
+
+bool bitmap_add(Bitmap* b, int64 x)
+{
+  bm_check(x);
+  int64 idx = bm_find(b, x >> 16);
+  if (idx < 0){
+    idx = -idx - 1;
+    bc_init_array(bm_insert(b, idx), x >> 16, 4);
+  }
+  return bc_add(&(b->cs[idx]), x & 0xFFFF);
+}
+
+bool bitmap_remove(Bitmap* b, int64 x)
+{
+  if (x < 0) return false;
+  const int64 idx = bm_find(b, x >> 16);
+  if (idx < 0) return false;
+  if (not bc_remove(&(b->cs[idx]), x & 0xFFFF)) return false;
+  if (b->cs[idx].card == 0){
+    memmove(b->cs + idx, b->cs + idx + 1,
+            (b->size - idx - 1) * sizeof(BmContainer));
+    b->size--;
+  }
+  return true;
+}
+
+bool bitmap_contains(Bitmap* b, int64 x)
+{
+  if (x < 0) return false;
+  const int64 idx = bm_find(b, x >> 16);
+  if (idx < 0) return false;
+  return bc_contains(&(b->cs[idx]), x & 0xFFFF);
+}
+
+int64 bitmap_size(Bitmap* b)
+{
+  int64 size = 0;
+  for (int64 i = 0; i < b->size; i++){
+    size += b->cs[i].card;
+  }
+  return size;
+}
+
+bool bitmap_next(Bitmap* b, int64* c, int64* pos, int64* x)
+{
+  for (; *c < b->size; (*c)++, *pos = 0){
+    BmContainer* cont = &(b->cs[*c]);
+    if (cont->bits == NULL){
+      if (*pos < cont->card){
+        *x = (int64) (cont->key << 16) | cont->array[*pos];
+        (*pos)++;
+        return true;
+      }
+      continue;
+    }
+    for (int64 word = *pos >> 6; word < BM_WORDS; word++){
+      uint64 w = cont->bits[word];
+      if (word == *pos >> 6) w &= ~0ULL << (*pos & 63);
+      if (w != 0){
+        const int64 v = word * 64 + __builtin_ctzll(w);
+        *x = (int64) (cont->key << 16) | v;
+        *pos = v + 1;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void bitmap_or(Bitmap* out, Bitmap* a, Bitmap* b)
+{
+  int64 i = 0, j = 0;
+  BmContainer c;
+  while (i < a->size or j < b->size){
+    if (j == b->size or (i < a->size and a->cs[i].key < b->cs[j].key)){
+      bc_copy(&c, &(a->cs[i++]));
+    } else if (i == a->size or b->cs[j].key < a->cs[i].key){
+      bc_copy(&c, &(b->cs[j++]));
+    } else {
+      bc_or(&c, &(a->cs[i++]), &(b->cs[j++]));
+    }
+    bm_append(out, &c);
+  }
+}
+
+void bitmap_and(Bitmap* out, Bitmap* a, Bitmap* b)
+{
+  int64 i = 0, j = 0;
+  BmContainer c;
+  while (i < a->size and j < b->size){
+    if (a->cs[i].key < b->cs[j].key) i++;
+    else if (a->cs[i].key > b->cs[j].key) j++;
+    else {
+      bc_and(&c, &(a->cs[i++]), &(b->cs[j++]));
+      bm_append(out, &c);
+    }
+  }
+}
+
+void bitmap_andnot(Bitmap* out, Bitmap* a, Bitmap* b)
+{
+  int64 j = 0;
+  BmContainer c;
+  for (int64 i = 0; i < a->size; i++){
+    while (j < b->size and b->cs[j].key < a->cs[i].key) j++;
+    if (j < b->size and b->cs[j].key == a->cs[i].key){
+      bc_andnot(&c, &(a->cs[i]), &(b->cs[j]));
+    } else {
+      bc_copy(&c, &(a->cs[i]));
+    }
+    bm_append(out, &c);
+  }
+}
+
+int64 bitmap_and_size(Bitmap* a, Bitmap* b)
+{
+  int64 i = 0, j = 0, size = 0;
+  while (i < a->size and j < b->size){
+    if (a->cs[i].key < b->cs[j].key) i++;
+    else if (a->cs[i].key > b->cs[j].key) j++;
+    else size += bc_and_card(&(a->cs[i++]), &(b->cs[j++]));
+  }
+  return size;
+}
+
+bool bitmap_is_subset(Bitmap* a, Bitmap* b)
+{
+  int64 j = 0;
+  for (int64 i = 0; i < a->size; i++){
+    while (j < b->size and b->cs[j].key < a->cs[i].key) j++;
+    if (j == b->size or b->cs[j].key != a->cs[i].key) return false;
+    if (a->cs[i].card > b->cs[j].card) return false;
+    if (bc_and_card(&(a->cs[i]), &(b->cs[j])) != a->cs[i].card) return false;
+  }
+  return true;
+}
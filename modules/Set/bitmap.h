@@ -0,0 +1,41 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+// A set of non-negative integers, split by their upper bits into containers
+// of 2^16 values.  A container holds a sorted array of the lower 16 bits while
+// it has at most BM_ARRAY_MAX elements, and a bitmap of BM_WORDS words
+// otherwise.
+#define BM_ARRAY_MAX  4096
+#define BM_WORDS      1024
+
+typedef struct {
+  uint64 key;       // Upper bits of the elements.
+  int64 card;
+  int64 alloc;      // Capacity of array.
+  uint16* array;    // NULL in a bitmap container.
+  uint64* bits;     // NULL in an array container.
+} BmContainer;
+
+typedef struct {
+  int64 size;       // Number of containers, sorted by key.
+  int64 alloc;
+  BmContainer* cs;
+} Bitmap;
+
+void bitmap_init(Bitmap* b);
+bool bitmap_add(Bitmap* b, int64 x);
+bool bitmap_remove(Bitmap* b, int64 x);
+bool bitmap_contains(Bitmap* b, int64 x);
+int64 bitmap_size(Bitmap* b);
+// Next element after position (*c, *pos), which start at 0.  Returns false
+// at the end.
+bool bitmap_next(Bitmap* b, int64* c, int64* pos, int64* x);
+
+// out must be empty, and distinct from a and b.
+void bitmap_or(Bitmap* out, Bitmap* a, Bitmap* b);
+void bitmap_and(Bitmap* out, Bitmap* a, Bitmap* b);
+void bitmap_andnot(Bitmap* out, Bitmap* a, Bitmap* b);
+int64 bitmap_and_size(Bitmap* a, Bitmap* b);
+bool bitmap_is_subset(Bitmap* a, Bitmap* b);
+
+#endif
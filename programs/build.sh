@@ -2,3 +2,4 @@
 
 product/ripe -b -m Gsl programs/shuffle.rip -o programs/shuffle
 product/ripe -b programs/check_white.rip -o programs/check_white
+product/ripe -b programs/bench_arith.rip -o programs/bench_arith
@@ -55,6 +55,7 @@ static void bootstrap(const char* out_filename, int arg1, int argc, char* const*
     }
   }
 
+  stran_infer();
   genist_run();
 
   for (uint i = 0; i < asts.size; i++){
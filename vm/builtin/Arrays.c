@@ -25,6 +25,37 @@ Array1* val_to_array1(Value v_array)
   return obj_c_data(v_array);
 }
 
+// Initialize a fresh array with room for alloc_size elements.
+void array1_init(Array1* a, uint64 alloc_size)
+{
+  if (alloc_size <= ARRAY1_SMALL){
+    a->data = a->small;
+    a->alloc_size = ARRAY1_SMALL;
+  } else {
+    a->data = mem_malloc(sizeof(Value) * alloc_size);
+    a->alloc_size = alloc_size;
+  }
+  a->size = 0;
+}
+
+// Change the capacity of a to alloc_size elements, keeping its contents.
+static void array1_realloc(Array1* a, uint64 alloc_size)
+{
+  if (alloc_size <= ARRAY1_SMALL){
+    if (a->data != a->small){
+      memcpy(a->small, a->data, sizeof(Value) * a->size);
+      a->data = a->small;
+    }
+    alloc_size = ARRAY1_SMALL;
+  } else if (a->data == a->small){
+    a->data = mem_malloc(sizeof(Value) * alloc_size);
+    memcpy(a->data, a->small, sizeof(Value) * a->size);
+  } else {
+    a->data = mem_realloc(a->data, sizeof(Value) * alloc_size);
+  }
+  a->alloc_size = alloc_size;
+}
+
 Value array1_to_val2(int num_args, ...)
 {
   va_list ap;
@@ -32,9 +63,8 @@ Value array1_to_val2(int num_args, ...)
 
   Array1* array;
   Value v = obj_new(klass_Array1, (void**) &array);
+  array1_init(array, num_args);
   array->size = num_args;
-  array->alloc_size = num_args;
-  array->data = mem_malloc(sizeof(Value) * array->alloc_size);
   for (int i = 0; i < num_args; i++){
     array->data[i] = va_arg(ap, Value);
   }
@@ -47,12 +77,9 @@ Value array1_to_val(int64 num_elements, Value* data)
 {
   Array1* array;
   Value v = obj_new(klass_Array1, (void**) &array);
+  array1_init(array, num_elements * 2);
   array->size = num_elements;
-  array->alloc_size = num_elements * 2;
-  array->data = mem_malloc(sizeof(Value) * array->alloc_size);
-  for (int64 i = 0; i < num_elements; i++){
-    array->data[i] = data[i];
-  }
+  memcpy(array->data, data, sizeof(Value) * num_elements);
   return v;
 }
 
@@ -60,9 +87,8 @@ Value array1_new(int64 num_elements)
 {
   Array1* array;
   Value v = obj_new(klass_Array1, (void**) &array);
+  array1_init(array, num_elements * 2);
   array->size = num_elements;
-  array->alloc_size = num_elements * 2;
-  array->data = mem_malloc(sizeof(Value) * num_elements);
   return v;
 }
 
@@ -83,29 +109,21 @@ Value array1_pop(Array1* a)
 
   uint64 size = a->size - 1;
   Value rv = a->data[size];
-  if (size*4 < a->alloc_size){
-    a->alloc_size /= 2;
-    if (a->alloc_size < 2) a->alloc_size = 2;
-    a->data = mem_realloc(a->data, sizeof(Value) * a->alloc_size);
-  }
   a->size = size;
+  if (size*4 < a->alloc_size and a->data != a->small){
+    array1_realloc(a, a->alloc_size / 2);
+  }
   return rv;
 }
 
 void array1_push(Array1* a, Value val)
 {
   uint64 size = a->size + 1;
-  a->size = size;
   if (size > a->alloc_size) {
-    a->alloc_size *= 2;
-    if (a->alloc_size == 0) {
-      a->alloc_size = 2;
-      a->data = mem_malloc(sizeof(Value) * a->alloc_size);
-    } else {
-      a->data = mem_realloc(a->data, sizeof(Value) * a->alloc_size);
-    }
+    array1_realloc(a, a->alloc_size * 2);
   }
   a->data[size - 1] = val;
+  a->size = size;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -15,7 +15,8 @@
 
 #include "vm/vm.h"
 
-double val_to_double(Value v)
+// Integers are converted, anything else but a Double is an error.
+double val_to_double_slow(Value v)
 {
   if (is_int64(v)) return (double) unpack_int64(v);
   obj_verify(v, klass_Double);
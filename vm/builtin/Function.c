@@ -16,10 +16,31 @@
 #include "vm/vm.h"
 
 Klass* klass_func;
+Klass* klass_Generator;
+
+// A Generator follows the iterator protocol: it is its own iterator.
+static Value generator_get_iter(Value v_gen)
+{
+  return v_gen;
+}
+
+static Value generator_iter(Value v_gen)
+{
+  Generator* gen = obj_c_data(v_gen);
+  return gen->resume(gen->frame);
+}
 
 void init1_Function(){
   klass_func = klass_new(dsym_get("Function"),
                          sizeof(Func));
+  klass_Generator = klass_new(dsym_get("Generator"),
+                              sizeof(Generator));
+  klass_new_method(klass_Generator,
+                   dsym_get("get_iter"),
+                   func1_to_val(generator_get_iter));
+  klass_new_method(klass_Generator,
+                   dsym_get("iter"),
+                   func1_to_val(generator_iter));
 }
 
 void init2_Function(){
@@ -73,3 +94,12 @@ Value block_to_val(void* c_func, int num_params, int block_elems, ...)
   for (int i = 0; i < block_elems; i++) func->block_data[i] = va_arg(ap, Value);
   return f;
 }
+
+Value generator_to_val(Value (*resume)(void* frame), void* frame)
+{
+  Generator* gen;
+  Value v = obj_new(klass_Generator, (void**) &gen);
+  gen->resume = resume;
+  gen->frame = frame;
+  return v;
+}
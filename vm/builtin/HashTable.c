@@ -15,169 +15,279 @@
 
 #include "vm/vm.h"
 
-static uint64 query(BucketType* buckets, Value* keys, uint64 size, Value key)
+// The table is split in groups of HT_GROUP slots.  A key is looked for
+// in the group its hash selects, then in further groups by triangular probing
+// (which visits every group, as the number of groups is a power of 2).  The
+// search stops at the first group with an empty slot.  Groups are scanned
+// through their control bytes, with SSE2 where available, so op_equal2 is
+// only called on slots whose 7 bits of hash match.
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Bit i is set if ctrl[i] == c.
+static inline uint32 group_match(const uint8* ctrl, uint8 c)
 {
-  const uint64 h = op_hash(key);
-  bool first_empty = false;
-  uint64 first_empty_place = 100000000; // This should not get returned.
-                                        // If it does, it will hopefully
-                                        // crash :)
-
-  for (uint64 idx = 0; idx < size; idx++){
-    // Quadratic probing
-    uint64 place = (h + idx*idx) % size;
-
-    switch(buckets[place]){
-      case BUCKET_EMPTY:
-        if (first_empty) return first_empty_place;
-        return place;
-      case BUCKET_WAS_FULL:
-        if (not first_empty){
-          first_empty = true;
-          first_empty_place = place;
-        }
-        break;
-      case BUCKET_FULL:
-        if (op_equal2(key, keys[place])) return place;
-        break;
-    }
+#ifdef __SSE2__
+  const __m128i group = _mm_loadu_si128((const __m128i*) ctrl);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+  uint32 mask = 0;
+  for (int i = 0; i < HT_GROUP; i++){
+    if (ctrl[i] == c) mask |= 1 << i;
   }
-  if (first_empty) return first_empty_place;
-  assert_never();
-  return 1000000000;
+  return mask;
+#endif
 }
 
-static void rehash(HashTable* ht, bool do_values)
+// Bit i is set if slot i is empty or deleted.
+static inline uint32 group_match_free(const uint8* ctrl)
 {
-  uint64 new_alloc_size = map_prime(ht->alloc_size);
-  BucketType* new_buckets = mem_calloc(sizeof(BucketType) * new_alloc_size);
-  Value* new_keys = mem_calloc(sizeof(Value) * new_alloc_size);
-  Value* new_values = NULL;
-  if (do_values) new_values = mem_calloc(sizeof(Value) * new_alloc_size);
-
-  const uint64 alloc_size = ht->alloc_size;
-  for (uint64 i = 0; i < alloc_size; i++){
-    if (ht->buckets[i] == BUCKET_FULL){
-      const Value key = ht->keys[i];
-      const uint64 place = query(new_buckets, new_keys, new_alloc_size, key);
-      new_buckets[place] = BUCKET_FULL;
-      new_keys[place] = key;
-      if (do_values) new_values[place] = ht->values[i];
-    }
-  }
-
-  ht->alloc_size = new_alloc_size;
-  mem_free(ht->buckets); ht->buckets = new_buckets;
-  mem_free(ht->keys); ht->keys = new_keys;
-  if (do_values){
-    mem_free(ht->values); ht->values = new_values;
+#ifdef __SSE2__
+  const __m128i group = _mm_loadu_si128((const __m128i*) ctrl);
+  return ~_mm_movemask_epi8(group) & 0xFFFF;
+#else
+  uint32 mask = 0;
+  for (int i = 0; i < HT_GROUP; i++){
+    if (not (ctrl[i] & CTRL_FULL)) mask |= 1 << i;
   }
+  return mask;
+#endif
 }
 
-bool ht_query(HashTable* ht, Value key)
+// The group takes the low bits of the hash, folded with the high ones for
+// hashes that aren't mixed, and the control byte takes different bits.
+static inline uint64 hash_group(uint64 alloc_size, uint64 h)
 {
-  uint64 place = query(ht->buckets, ht->keys, ht->alloc_size, key);
-  return ht->buckets[place] == BUCKET_FULL;
+  return (h ^ (h >> 32)) / HT_GROUP & (alloc_size / HT_GROUP - 1);
 }
 
-bool ht_query2(HashTable* ht, Value key, Value* value)
+static inline uint8 hash_ctrl(uint64 h)
 {
-  uint64 place = query(ht->buckets, ht->keys, ht->alloc_size, key);
-  if (ht->buckets[place] != BUCKET_FULL) return false;
-  if (value != NULL) *value = ht->values[place];
-  return true;
+  return CTRL_FULL | ((h * 0x9E3779B97F4A7C15ULL) >> 57);
 }
 
-bool ht_remove(HashTable* ht, Value key)
+// Returns an empty or deleted slot for a hash.
+static uint64 find_free(const uint8* ctrl, uint64 alloc_size, uint64 h)
 {
-  uint64 place = query(ht->buckets, ht->keys, ht->alloc_size, key);
-  if (ht->buckets[place] == BUCKET_FULL){
-    ht->size--;
-    ht->buckets[place] = BUCKET_WAS_FULL;
-    ht->keys[place] = VALUE_NIL;
-    return true;
+  const uint64 num_groups = alloc_size / HT_GROUP;
+  uint64 group = hash_group(alloc_size, h);
+  for (uint64 step = 1; ; step++){
+    const uint32 mask = group_match_free(ctrl + group * HT_GROUP);
+    if (mask != 0) return group * HT_GROUP + __builtin_ctz(mask);
+    group = (group + step) & (num_groups - 1);
   }
-  return false;
 }
 
-// TODO: This function is almost carbon copy of ht_set2. Maybe there's a
-// way not to duplicate code but I do not want to do any checks at runtime.
-void ht_set(HashTable* ht, Value key)
+// Smallest table that holds items at most 7/8 full.
+static uint64 capacity_for(int64 items)
 {
-  uint64 place = query(ht->buckets, ht->keys, ht->alloc_size, key);
-  if (ht->buckets[place] == BUCKET_FULL) return;
+  uint64 capacity = HT_GROUP;
+  while ((uint64) items > capacity / 8 * 7) capacity *= 2;
+  return capacity;
+}
 
-  // So, hash table size will increase by one.
-  ht->size++;
+// Marks a removed entry.  Only its address is used.
+uint64 ht_removed_entry[2] __attribute__ ((aligned (16)));
 
-  // If map has room in it, simply add it.
-  if (ht->size * 2 < ht->alloc_size){
-    ht->buckets[place] = BUCKET_FULL;
-    ht->keys[place] = key;
-    return;
+// Returns the slot of key, or -1.  The entry is in ht->index[slot].
+static int64 find(HashTable* ht, Value key, uint64 h)
+{
+  const uint8 c = hash_ctrl(h);
+  const uint64 num_groups = ht->alloc_size / HT_GROUP;
+  uint64 group = hash_group(ht->alloc_size, h);
+  for (uint64 step = 1; step <= num_groups; step++){
+    const uint8* ctrl = ht->ctrl + group * HT_GROUP;
+    uint32 mask = group_match(ctrl, c);
+    while (mask != 0){
+      const uint64 slot = group * HT_GROUP + __builtin_ctz(mask);
+      const Value k = ht->keys[ht->index[slot]];
+      if (k == key or op_equal2(key, k)) return slot;
+      mask &= mask - 1;
+    }
+    if (group_match(ctrl, CTRL_EMPTY) != 0) return -1;
+    group = (group + step) & (num_groups - 1);
   }
+  return -1;
+}
 
-  // Otherwise, expand the table and rehash
-  rehash(ht, false);
+// Replaces the slots by alloc_size new ones, pointing to the live entries.
+static void reindex(HashTable* ht, uint64 alloc_size)
+{
+  if (ht->ctrl != NULL){
+    mem_free(ht->ctrl);
+    mem_free(ht->index);
+  }
+  ht->alloc_size = alloc_size;
+  ht->deleted = 0;
+  ht->ctrl = mem_calloc_atomic(alloc_size);
+  ht->index = mem_malloc_atomic(alloc_size * sizeof(uint32));
+  for (uint64 e = 0; e < ht->count; e++){
+    if (not ht_live(ht, e)) continue;
+    const uint64 h = op_hash(ht->keys[e]);
+    const uint64 slot = find_free(ht->ctrl, alloc_size, h);
+    ht->ctrl[slot] = hash_ctrl(h);
+    ht->index[slot] = e;
+  }
+}
 
-  // Find a place again, and put the key in
-  place = query(ht->buckets, ht->keys, ht->alloc_size, key);
-  ht->buckets[place] = BUCKET_FULL;
-  ht->keys[place] = key;
+static void alloc_entries(HashTable* ht, uint64 entries_alloc)
+{
+  ht->entries_alloc = entries_alloc;
+  ht->keys = mem_realloc(ht->keys, entries_alloc * sizeof(Value));
+  if (ht->values != NULL)
+    ht->values = mem_realloc(ht->values, entries_alloc * sizeof(Value));
 }
 
-void ht_set2(HashTable* ht, Value key, Value value)
+// Squeezes out the removed entries, keeping the order of the others, and
+// reindexes for the remaining size.
+static void compact(HashTable* ht)
 {
-  uint64 place = query(ht->buckets, ht->keys, ht->alloc_size, key);
-  if (ht->buckets[place] == BUCKET_FULL) {
-    ht->values[place] = value;
-    return;
+  uint64 n = 0;
+  for (uint64 e = 0; e < ht->count; e++){
+    if (not ht_live(ht, e)) continue;
+    ht->keys[n] = ht->keys[e];
+    if (ht->values != NULL) ht->values[n] = ht->values[e];
+    n++;
+  }
+  for (uint64 e = n; e < ht->count; e++){
+    ht->keys[e] = VALUE_NIL;
+    if (ht->values != NULL) ht->values[e] = VALUE_NIL;
   }
+  ht->count = n;
+  if (ht->entries_alloc > 4 * n and ht->entries_alloc > 8)
+    alloc_entries(ht, 2 * n > 4 ? 2 * n : 4);
+  reindex(ht, capacity_for(2 * ht->size));
+}
 
-  // So, hash table size will increase by one.
+// Appends a new entry for key, and returns it.
+static uint64 insert(HashTable* ht, Value key, uint64 h)
+{
+  // Shrink a table that removals left mostly empty.  This waits for an
+  // insert, as removing during a walk of the table must not move entries.
+  if (ht->alloc_size > HT_GROUP and ht->size < ht->alloc_size / 8
+       and ht->count - ht->size > ht->size){
+    compact(ht);
+  }
+  if (ht->count == ht->entries_alloc){
+    if (ht->count - ht->size >= ht->count / 2 and ht->count > 0){
+      compact(ht);
+    } else {
+      alloc_entries(ht, 2 * ht->entries_alloc);
+    }
+  }
+  if (ht->size + ht->deleted + 1 > ht->alloc_size / 8 * 7){
+    if (ht->size + 1 <= ht->alloc_size / 16 * 7){
+      reindex(ht, ht->alloc_size);
+    } else {
+      reindex(ht, ht->alloc_size * 2);
+    }
+  }
+  const uint64 slot = find_free(ht->ctrl, ht->alloc_size, h);
+  if (ht->ctrl[slot] == CTRL_DELETED) ht->deleted--;
+  ht->ctrl[slot] = hash_ctrl(h);
+  const uint64 e = ht->count++;
+  ht->index[slot] = e;
+  ht->keys[e] = key;
   ht->size++;
+  return e;
+}
+
+bool ht_query(HashTable* ht, Value key)
+{
+  return find(ht, key, op_hash(key)) >= 0;
+}
+
+bool ht_query2(HashTable* ht, Value key, Value* value)
+{
+  const int64 slot = find(ht, key, op_hash(key));
+  if (slot < 0) return false;
+  if (value != NULL) *value = ht->values[ht->index[slot]];
+  return true;
+}
+
+bool ht_remove(HashTable* ht, Value key)
+{
+  const int64 slot = find(ht, key, op_hash(key));
+  if (slot < 0) return false;
 
-  // If map has room in it, simply add it.
-  if (ht->size * 2 < ht->alloc_size){
-    ht->buckets[place] = BUCKET_FULL;
-    ht->keys[place] = key;
-    ht->values[place] = value;
-    return;
+  ht->size--;
+  // No search goes past a group with an empty slot, so a slot in such a
+  // group can be emptied rather than deleted.
+  const uint8* ctrl = ht->ctrl + slot / HT_GROUP * HT_GROUP;
+  if (group_match(ctrl, CTRL_EMPTY) != 0){
+    ht->ctrl[slot] = CTRL_EMPTY;
+  } else {
+    ht->ctrl[slot] = CTRL_DELETED;
+    ht->deleted++;
   }
+  const uint64 e = ht->index[slot];
+  ht->keys[e] = HT_REMOVED;
+  if (ht->values != NULL) ht->values[e] = VALUE_NIL;
+  // The entries stay where they are, so that loops walking them may remove
+  // keys as they go; insert() squeezes out the holes.
+  return true;
+}
 
-  // Otherwise, expand the table and rehash
-  rehash(ht, true);
+void ht_set(HashTable* ht, Value key)
+{
+  const uint64 h = op_hash(key);
+  if (find(ht, key, h) >= 0) return;
+  insert(ht, key, h);
+}
 
-  // Find a place again, and put the key in
-  place = query(ht->buckets, ht->keys, ht->alloc_size, key);
-  ht->buckets[place] = BUCKET_FULL;
-  ht->keys[place] = key;
-  ht->values[place] = value;
+void ht_set2(HashTable* ht, Value key, Value value)
+{
+  const uint64 h = op_hash(key);
+  const int64 slot = find(ht, key, h);
+  uint64 e;
+  if (slot >= 0){
+    e = ht->index[slot];
+  } else {
+    e = insert(ht, key, h);
+  }
+  ht->values[e] = value;
 }
 
-void ht_init(HashTable* ht, int64 items)
+static void init(HashTable* ht, int64 items, bool do_values)
 {
   ht->size = 0;
-  ht->alloc_size = map_prime(items);
-  ht->buckets = mem_calloc(ht->alloc_size*sizeof(BucketType));
-  ht->keys = mem_calloc(ht->alloc_size*sizeof(Value));
+  ht->count = 0;
+  ht->entries_alloc = items > 4 ? items : 4;
+  ht->keys = mem_malloc(ht->entries_alloc * sizeof(Value));
   ht->values = NULL;
+  if (do_values) ht->values = mem_malloc(ht->entries_alloc * sizeof(Value));
+  ht->ctrl = NULL;
+  reindex(ht, capacity_for(items));
+}
+
+void ht_init(HashTable* ht, int64 items)
+{
+  init(ht, items, false);
 }
 
 void ht_init2(HashTable* ht, int64 items)
 {
-  ht->size = 0;
-  ht->alloc_size = map_prime(items);
-  ht->buckets = mem_calloc(ht->alloc_size*sizeof(BucketType));
-  ht->keys = mem_calloc(ht->alloc_size*sizeof(Value));
-  ht->values = mem_calloc(ht->alloc_size*sizeof(Value));
+  init(ht, items, true);
+}
+
+void ht_reserve(HashTable* ht, int64 items)
+{
+  if (items <= (int64) ht->size) return;
+  const uint64 entries = ht->count + (items - ht->size);
+  if (entries > ht->entries_alloc) alloc_entries(ht, entries);
+  if (capacity_for(items) > ht->alloc_size) reindex(ht, capacity_for(items));
 }
 
 void ht_clear(HashTable* ht)
 {
-  mem_free(ht->buckets);
+  const bool do_values = ht->values != NULL;
+  mem_free(ht->ctrl);
+  mem_free(ht->index);
   mem_free(ht->keys);
-  ht_init(ht, 0);
+  if (do_values) mem_free(ht->values);
+  init(ht, 0, do_values);
 }
 
 Value ht_new_map(const int64 num_args, ...)
@@ -204,7 +314,7 @@ Value ht_new_set(const int64 num_args, ...)
 
   HashTable* ht;
   const Value v_set = obj_new(klass_Set, (void**) &ht);
-  ht_init2(ht, num_args);
+  ht_init(ht, num_args);
   for (int64 i = 0; i < num_args; i++){
     const Value key = va_arg(ap, Value);
     ht_set(ht, key);
@@ -212,3 +322,194 @@ Value ht_new_set(const int64 num_args, ...)
   va_end(ap);
   return v_set;
 }
+
+HashTable* val_to_map(Value v_map)
+{
+  obj_verify(v_map, klass_Map);
+  return obj_c_data(v_map);
+}
+
+HashTable* val_to_set(Value v_set)
+{
+  obj_verify(v_set, klass_Set);
+  return obj_c_data(v_set);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// TypedTable
+//////////////////////////////////////////////////////////////////////////////
+
+// The slots of a HashTable, with the keys and values in the slots, compared
+// without op_equal2.
+// An Integer key is stored as is; a String key is copied, and its hash is
+// stored in keys so that most mismatches are found without touching the
+// String.
+
+static inline uint64 tt_hash_int(int64 key)
+{
+  return hash_mix64(key ^ hash_seed);
+}
+
+static inline uint64 tt_hash(TypedTable* tt, uint64 place)
+{
+  if (tt->strings != NULL) return tt->keys[place];
+  return tt_hash_int(tt->keys[place]);
+}
+
+static void tt_alloc(TypedTable* tt, uint64 alloc_size, bool string_keys,
+                     bool do_values)
+{
+  tt->alloc_size = alloc_size;
+  tt->deleted = 0;
+  tt->removed = 0;
+  tt->ctrl = mem_calloc_atomic(alloc_size);
+  tt->keys = mem_calloc_atomic(alloc_size * sizeof(int64));
+  tt->strings = NULL;
+  if (string_keys) tt->strings = mem_calloc(alloc_size * sizeof(Value));
+  tt->values = NULL;
+  if (do_values) tt->values = mem_calloc(alloc_size * sizeof(Value));
+}
+
+// Rehashes into a table of alloc_size, which also drops deleted slots.
+static void tt_resize(TypedTable* tt, uint64 alloc_size)
+{
+  TypedTable old = *tt;
+  tt_alloc(tt, alloc_size, old.strings != NULL, old.values != NULL);
+  for (uint64 i = 0; i < old.alloc_size; i++){
+    if (not (old.ctrl[i] & CTRL_FULL)) continue;
+    const uint64 h = tt_hash(&old, i);
+    const uint64 place = find_free(tt->ctrl, tt->alloc_size, h);
+    tt->ctrl[place] = hash_ctrl(h);
+    tt->keys[place] = old.keys[i];
+    if (old.strings != NULL) tt->strings[place] = old.strings[i];
+    if (old.values != NULL) tt->values[place] = old.values[i];
+  }
+  mem_free(old.ctrl);
+  mem_free(old.keys);
+  if (old.strings != NULL) mem_free(old.strings);
+  if (old.values != NULL) mem_free(old.values);
+}
+
+static inline bool tt_string_equal(Value v, const char* str, int64 size)
+{
+  String* s = obj_c_data(v);
+  return s->size == size and memcmp(s->str, str, size) == 0;
+}
+
+// Returns the place of the key (an Integer, or the hash of str), or -1.
+static int64 tt_find2(TypedTable* tt, int64 key, uint64 h, const char* str,
+                      int64 size)
+{
+  const uint8 c = hash_ctrl(h);
+  const uint64 num_groups = tt->alloc_size / HT_GROUP;
+  uint64 group = hash_group(tt->alloc_size, h);
+  for (uint64 step = 1; step <= num_groups; step++){
+    const uint8* ctrl = tt->ctrl + group * HT_GROUP;
+    uint32 mask = group_match(ctrl, c);
+    while (mask != 0){
+      const uint64 place = group * HT_GROUP + __builtin_ctz(mask);
+      if (tt->keys[place] == key
+           and (str == NULL
+                or tt_string_equal(tt->strings[place], str, size)))
+        return place;
+      mask &= mask - 1;
+    }
+    if (group_match(ctrl, CTRL_EMPTY) != 0) return -1;
+    group = (group + step) & (num_groups - 1);
+  }
+  return -1;
+}
+
+// Unpacks key into its stored form and hash.  Raises if it has the wrong
+// type.
+static inline void tt_unpack(TypedTable* tt, Value key, int64* k, uint64* h,
+                             String** s)
+{
+  if (tt->strings != NULL){
+    obj_verify(key, klass_String);
+    *s = obj_c_data(key);
+    *h = string_hash(*s);
+    *k = *h;
+  } else {
+    *k = val_to_int64(key);
+    *h = tt_hash_int(*k);
+    *s = NULL;
+  }
+}
+
+int64 tt_find(TypedTable* tt, Value key)
+{
+  // A key of the wrong type can't be there.
+  if (tt->strings != NULL ? obj_klass(key) != klass_String
+                          : not is_int64(key)) return -1;
+  int64 k;
+  uint64 h;
+  String* s;
+  tt_unpack(tt, key, &k, &h, &s);
+  if (s == NULL) return tt_find2(tt, k, h, NULL, 0);
+  return tt_find2(tt, k, h, s->str, s->size);
+}
+
+uint64 tt_insert(TypedTable* tt, Value key)
+{
+  int64 k;
+  uint64 h;
+  String* s;
+  tt_unpack(tt, key, &k, &h, &s);
+  int64 place = (s == NULL) ? tt_find2(tt, k, h, NULL, 0)
+                            : tt_find2(tt, k, h, s->str, s->size);
+  if (place >= 0) return place;
+
+  // Shrink a table that removals left mostly empty.  This waits for an
+  // insert, as removing during a walk of the table must not move keys.
+  if (tt->alloc_size > HT_GROUP and tt->size < tt->alloc_size / 8
+       and tt->removed > tt->size){
+    tt_resize(tt, capacity_for(2 * tt->size));
+  }
+  if (tt->size + tt->deleted + 1 > tt->alloc_size / 8 * 7){
+    if (tt->size + 1 <= tt->alloc_size / 16 * 7){
+      tt_resize(tt, tt->alloc_size);
+    } else {
+      tt_resize(tt, tt->alloc_size * 2);
+    }
+  }
+  place = find_free(tt->ctrl, tt->alloc_size, h);
+  if (tt->ctrl[place] == CTRL_DELETED) tt->deleted--;
+  tt->ctrl[place] = hash_ctrl(h);
+  tt->keys[place] = k;
+  // Copy the String, so that changing the original doesn't move the key.
+  if (s != NULL) tt->strings[place] = stringn_to_val(s->str, s->size);
+  tt->size++;
+  return place;
+}
+
+bool tt_remove(TypedTable* tt, Value key)
+{
+  const int64 place = tt_find(tt, key);
+  if (place < 0) return false;
+
+  tt->size--;
+  const uint8* ctrl = tt->ctrl + place / HT_GROUP * HT_GROUP;
+  if (group_match(ctrl, CTRL_EMPTY) != 0){
+    tt->ctrl[place] = CTRL_EMPTY;
+  } else {
+    tt->ctrl[place] = CTRL_DELETED;
+    tt->deleted++;
+  }
+  if (tt->strings != NULL) tt->strings[place] = VALUE_NIL;
+  if (tt->values != NULL) tt->values[place] = VALUE_NIL;
+  tt->removed++;
+  return true;
+}
+
+Value tt_key(TypedTable* tt, uint64 place)
+{
+  if (tt->strings != NULL) return tt->strings[place];
+  return int64_to_val(tt->keys[place]);
+}
+
+void tt_init(TypedTable* tt, bool string_keys, bool do_values, int64 items)
+{
+  tt->size = 0;
+  tt_alloc(tt, capacity_for(items), string_keys, do_values);
+}
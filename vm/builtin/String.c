@@ -22,34 +22,126 @@ char* val_to_string(Value v)
   return obj->str;
 }
 
+int64 string_size(Value v)
+{
+  obj_verify(v, klass_String);
+  String* obj = obj_c_data(v);
+  return obj->size;
+}
+
+uint64 string_hash(String* s)
+{
+  if (s->hash == 0){
+    uint64 h = hash_bytes_seed(s->str, s->size, hash_seed);
+    // 0 is reserved for "not computed"
+    s->hash = (h == 0) ? 1 : h;
+  }
+  return s->hash;
+}
+
 Value string_to_val(const char* str)
 {
   assert(str != NULL);
-  String* obj;
-  Value v = obj_new(klass_String, (void**)&obj);
-  obj->str = mem_strdup(str);
-  obj->type = STRING_REGULAR;
-  return v;
+  return stringn_to_val(str, strlen(str));
+}
+
+// Make room for size bytes (plus the terminating 0) in string v, keeping its
+// contents.  The buffer grows geometrically, so that appending repeatedly
+// takes amortized linear time.
+void string_reserve(Value v, int64 size)
+{
+  String* s = obj_c_data(v);
+  assert(s->type != STRING_CONST);
+  if (size < s->alloc) return;
+  int64 alloc = 2 * s->alloc;
+  if (alloc < size + 1) alloc = size + 1;
+  char* str = mem_malloc_atomic(alloc);
+  memcpy(str, s->str, s->size + 1);
+  s->str = str;
+  s->alloc = alloc;
+}
+
+// Strings are allocated with extra bytes of inline storage after the String
+// structure.  They are not atomic, so that str keeps a buffer allocated by
+// string_reserve() alive.
+static String* string_alloc(int64 extra, Value* v)
+{
+  Object* obj = mem_malloc(klass_String->obj_size + extra);
+  obj->klass = klass_String;
+  *v = pack_ptr(obj);
+  return (String*) obj->values;
 }
 
-Value stringn_to_val(const char* str, int n)
+// Unlike string_to_val, str may contain 0 bytes.
+Value stringn_to_val(const char* str, int64 n)
 {
   assert(str != NULL);
-  String* obj;
-  Value v = obj_new(klass_String, (void**)&obj);
-  obj->str = mem_malloc(n+1);
-  strncpy(obj->str, str, n);
+  Value v;
+  String* obj = string_alloc(n + 1, &v);
+  obj->str = (char*) (obj + 1);
+  memcpy(obj->str, str, n);
   obj->str[n] = 0;
   obj->type = STRING_REGULAR;
+  obj->size = n;
+  obj->alloc = n + 1;
+  obj->hash = 0;
+  return v;
+}
+
+Value string_concat(String* a, String* b)
+{
+  Value v;
+  String* obj = string_alloc(a->size + b->size + 1, &v);
+  obj->str = (char*) (obj + 1);
+  memcpy(obj->str, a->str, a->size);
+  memcpy(obj->str + a->size, b->str, b->size + 1);
+  obj->type = STRING_REGULAR;
+  obj->size = a->size + b->size;
+  obj->alloc = obj->size + 1;
+  obj->hash = 0;
   return v;
 }
 
+// str must be in static storage (see vm.h).
 Value string_const_to_val(const char* str)
 {
   assert(str != NULL);
-  String* obj;
-  Value v = obj_new(klass_String, (void**)&obj);
+  Value v;
+  String* obj = string_alloc(0, &v);
   obj->str = (char*) str;
   obj->type = STRING_CONST;
+  obj->size = strlen(str);
+  obj->alloc = 0;
+  obj->hash = 0;
   return v;
 }
+
+StringSwitch* string_switch_new(int n, Value* labels)
+{
+  StringSwitch* sw = mem_new(StringSwitch);
+  sw->slots = NULL;
+  int min_bits = 1;
+  while ((1 << min_bits) < 2 * n) min_bits++;
+  for (int bits = min_bits; bits < min_bits + 3; bits++){
+    const int size = 1 << bits;
+    int* slots = mem_malloc_atomic(size * sizeof(int));
+    for (uint64 seed = 1; seed <= 1000; seed++){
+      uint64 mult = (0x9E3779B97F4A7C15ULL * seed) | 1;
+      memset(slots, 0, size * sizeof(int));
+      int k;
+      for (k = 0; k < n; k++){
+        uint64 h = string_hash(obj_c_data(labels[k]));
+        uint64 slot = (h * mult) >> (64 - bits);
+        if (slots[slot] != 0) break;
+        slots[slot] = k + 1;
+      }
+      if (k == n){
+        sw->mult = mult;
+        sw->shift = 64 - bits;
+        sw->slots = slots;
+        return sw;
+      }
+    }
+  }
+  return sw;
+}
@@ -21,15 +21,25 @@ Tuple* val_to_tuple(Value v_tuple)
   return obj_c_data(v_tuple);
 }
 
+Value tuple_new(int64 size, Tuple** out)
+{
+  // One allocation: Object header, Tuple and then the elements.
+  Object* obj = mem_malloc(klass_Tuple->obj_size + sizeof(Value) * size);
+  obj->klass = klass_Tuple;
+  Tuple* tuple = (Tuple*) obj->values;
+  tuple->size = size;
+  tuple->data = (Value*) (tuple + 1);
+  *out = tuple;
+  return pack_ptr(obj);
+}
+
 Value tuple_to_val(uint16 num_args, ...)
 {
   va_list ap;
   va_start(ap, num_args);
 
   Tuple* tuple;
-  Value v = obj_new(klass_Tuple, (void**) &tuple);
-  tuple->size = num_args;
-  tuple->data = mem_malloc(sizeof(Value)*num_args);
+  Value v = tuple_new(num_args, &tuple);
   for (uint i = 0; i < num_args; i++){
     tuple->data[i] = va_arg(ap, Value);
   }
@@ -40,20 +50,8 @@ Value tuple_to_val(uint16 num_args, ...)
 Value tuple_to_val2(uint16 num_args, Value* stuff)
 {
   Tuple* tuple;
-  Value v = obj_new(klass_Tuple, (void**) &tuple);
-  tuple->size = num_args;
-  tuple->data = mem_malloc(sizeof(Value)*num_args);
-  for (uint i = 0; i < num_args; i++){
-    tuple->data[i] = stuff[i];
-  }
-  return v;
-}
-
-Value tuple_new(int64 size, Tuple** out)
-{
-  Value v = obj_new(klass_Tuple, (void**) out);
-  (*out)->size = size;
-  (*out)->data = mem_malloc(sizeof(Value) * size);
+  Value v = tuple_new(num_args, &tuple);
+  memcpy(tuple->data, stuff, sizeof(Value) * num_args);
   return v;
 }
 
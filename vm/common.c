@@ -31,6 +31,7 @@ Klass* klass_Nil;
 Klass* klass_Map;
 Klass* klass_Range;
 Klass* klass_Set;
+Klass* klass_StackOverflow;
 Klass* klass_String;
 Klass* klass_Tuple;
 
@@ -49,6 +50,7 @@ void common_init_phase15()
   klass_Nil = klass_get(dsym_get("Nil"));
   klass_Range = klass_get(dsym_get("Range"));
   klass_Set = klass_get(dsym_get("Set"));
+  klass_StackOverflow = klass_get(dsym_get("StackOverflow"));
   klass_String = klass_get(dsym_get("String"));
   klass_Tuple = klass_get(dsym_get("Tuple"));
 }
@@ -54,26 +54,26 @@ static void strip_whitespace(char* s)
 
 static const char* param_to_string(Value v)
 {
-  switch (v & MASK_TAIL){
-    case 0b00:
+  switch (value_tag(v)){
+    case TAG_PTR:
       if (v == VALUE_NIL) return "nil";
       if (v == VALUE_TRUE) return "true";
       if (v == VALUE_FALSE) return "false";
       if (v == VALUE_EOF) return "eof";
       return to_string(v);
-    case 0b01:
+    case TAG_INT64:
       {
         char buf[30];
         sprintf(buf, "%"PRId64, unpack_int64(v));
         return mem_strdup(buf);
       }
-    case 0b10:
+    case TAG_DOUBLE:
       {
         char buf[30];
         sprintf(buf, "%g", unpack_double(v));
         return mem_strdup(buf);
       }
-    case 0b11:
+    case TAG_EXTENDED:
       assert_never();
   }
   assert_never();
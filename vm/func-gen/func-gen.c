@@ -37,6 +37,27 @@ static void print_mult(const char* s, int n, int start_with_comma, int put_numbe
   }
 }
 
+// Prints the rest of a method caller once c_data has been looked up.
+static void print_method_body(int n)
+{
+  printf("  if (c_data->var_params){\n");
+  printf("    Value args[%d] = {v_obj", n+1);
+  print_mult("arg", n, 1, 1);
+  printf("};\n");
+  printf("    Value rv = func_call_opt_helper(c_data, %d, args);\n", n+1);
+  printf("    return rv;\n");
+  printf("  }\n");
+  printf("  if (c_data->num_params != %d){\n", n+1);
+  printf("    exc_raise(\"method that takes %%d arguments called with %%d\"\n");
+  printf("              \" arguments\", c_data->num_params-1, %d);\n", n);
+  printf("  }\n");
+  printf("  Value rv = c_data->func%d(v_obj", n+1);
+  print_mult("arg", n, 1, 1);
+  printf(");\n");
+  printf("  return rv;\n");
+  printf("}\n");
+}
+
 static void gen_c(void)
 {
   puts(header);
@@ -108,24 +129,17 @@ static void gen_c(void)
     printf("){\n");
     printf("  Value method = method_get(v_obj, dsym);\n");
     printf("  Func* c_data = obj_c_data(method);\n");
+    print_method_body(n);
+  }
 
-    printf("  if (c_data->var_params){\n");
-    printf("    Value args[%d] = {v_obj", n+1);
-    print_mult("arg", n, 1, 1);
-    printf("};\n");
-    printf("    Value rv = func_call_opt_helper(c_data, %d, args);\n", n+1);
-    printf("    return rv;\n");
-    printf("  }\n");
-    printf("  if (c_data->num_params != %d){\n", n+1);
-    printf("    exc_raise(\"method that takes %%d arguments called with %%d\"\n");
-    printf("              \" arguments\", c_data->num_params-1, %d);\n", n);
-    printf("  }\n");
-    printf("  Value rv = c_data->func%d(v_obj", n+1);
-    print_mult("arg", n, 1, 1);
-    printf(");\n");
-    printf("  return rv;\n");
-    printf("}\n");
-
+  printf("\n// cached callers\n");
+  for (int n = 0; n < MAX_PARAMS; n++){
+    printf("Value method_call%d_cached(MethodCache* mc, Value v_obj, Value dsym",
+           n);
+    print_mult("Value arg", n, 1, 1);
+    printf("){\n");
+    printf("  Func* c_data = method_cache_get(mc, v_obj, dsym);\n");
+    print_method_body(n);
   }
 }
 
@@ -157,6 +171,13 @@ static void gen_h(void)
   printf("  };\n  uint16 num_params;\n  uint16 var_params;\n  bool is_block;\n"
          "  uint16 block_elems;\n  Value* block_data;\n} Func;\n");
 
+  printf("\n// Per-call-site method cache (see method_cache_get in vm.h)\n");
+  printf("#define MCACHE_WAYS 2\n");
+  printf("typedef struct {\n"
+         "  struct KlassT* klass[MCACHE_WAYS];\n"
+         "  Func* func[MCACHE_WAYS];\n"
+         "} MethodCache;\n");
+
   printf("\n// constructors\n\n");
   for (int i = 0; i <= MAX_PARAMS; i++){
     printf("#define func%d_to_val(cfunc) "
@@ -175,6 +196,12 @@ static void gen_h(void)
     print_mult("Value arg", i, 1, 1);
     printf(");\n");
   }
+  for (int i = 0; i < MAX_PARAMS; i++){
+    printf("Value method_call%d_cached(MethodCache* mc, Value v_obj, Value dsym",
+           i);
+    print_mult("Value arg", i, 1, 1);
+    printf(");\n");
+  }
 
   printf("\n#endif\n");
 }
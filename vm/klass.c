@@ -13,17 +13,38 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <stddef.h>
 #include "vm/vm.h"
 
 Array klasses;
 Dict dsym_to_klass;
 
+#ifdef MCACHE_STATS
+uint64 mcache_hits = 0;
+uint64 mcache_misses = 0;
+
+static void mcache_report(void)
+{
+  uint64 total = mcache_hits + mcache_misses;
+  fprintf(stderr, "method cache: %"PRIu64" hits, %"PRIu64" misses (%.2f%%)\n",
+          mcache_hits, mcache_misses,
+          total > 0 ? 100.0 * mcache_hits / total : 0.0);
+}
+#endif
+
+// Until phase 1.5 every table is this one, with a single empty slot.
+static KlassTable* empty_table;
+
 void klass_init()
 {
+  empty_table = mem_calloc(sizeof(KlassTable) + sizeof(KlassSlot));
   array_init(&klasses, Klass*);
   // Initialize dsym_to_klass
   dict_init(&dsym_to_klass, sizeof(Value), sizeof(Klass*), dict_hash_uint32,
             dict_equal_uint32);
+#ifdef MCACHE_STATS
+  atexit(mcache_report);
+#endif
 }
 
 void klass_dump()
@@ -34,6 +55,96 @@ void klass_dump()
   }
 }
 
+//////////////////////////////////////////////////////////////////////////////
+// Dispatch tables
+//////////////////////////////////////////////////////////////////////////////
+
+static bool klasses_frozen = false;
+
+// Add key unless it is already there (entries closer to the class itself
+// are added first, so they override the parent's).
+static void table_add(KlassTable* t, Value key, Value value)
+{
+  uint64 i = ((uint64) unpack_int64(key)) & t->mask;
+  while (t->slots[i].key != 0){
+    if (t->slots[i].key == key) return;
+    i = (i + 1) & t->mask;
+  }
+  t->slots[i].key = key;
+  t->slots[i].value = value;
+}
+
+// Build a table for klass from the Dict at dict_offset inside Klass, walking
+// up the parent chain.  If only_virtual, inherited entries that are field
+// numbers (rather than virtual reader/writer functions) are skipped, since
+// the slot layout belongs to the class itself.
+static KlassTable* table_build(Klass* klass, size_t dict_offset,
+                               bool only_virtual)
+{
+  uint64 count = 0;
+  for (Klass* k = klass; k != NULL; k = k->parent){
+    count += ((Dict*) ((char*) k + dict_offset))->size;
+  }
+  // Keep load factor at most 1/2, and always leave an empty slot.
+  uint64 size = 1;
+  while (size < 2*count) size *= 2;
+  KlassTable* t = mem_calloc(sizeof(KlassTable) + size * sizeof(KlassSlot));
+  t->mask = size - 1;
+
+  for (Klass* k = klass; k != NULL; k = k->parent){
+    Dict* d = (Dict*) ((char*) k + dict_offset);
+    for (uint64 i = 0; i < d->alloc_size; i++){
+      if (not dict_has_bucket(d, i)) continue;
+      Value key = *(Value*) dict_get_bucket_key(d, i);
+      Value value = *(Value*) dict_get_bucket_value(d, i);
+      if (k != klass and only_virtual and value < 1024) continue;
+      table_add(t, key, value);
+    }
+  }
+  return t;
+}
+
+// The table is filled in before it is published.
+#define table_publish(place, t)  __atomic_store_n(&(place), t, __ATOMIC_RELEASE)
+
+static void klass_freeze(Klass* klass)
+{
+  table_publish(klass->t_methods,
+                table_build(klass, offsetof(Klass, methods), false));
+  table_publish(klass->t_readable,
+                table_build(klass, offsetof(Klass, readable_fields), true));
+  table_publish(klass->t_writable,
+                table_build(klass, offsetof(Klass, writable_fields), true));
+}
+
+static void klass_freeze_all(void)
+{
+  for (uint i = 0; i < klasses.size; i++){
+    klass_freeze(array_get(&klasses, Klass*, i));
+  }
+  klasses_frozen = true;
+}
+
+// Called whenever klass changes after phase 1.5.  The change may be
+// inherited, so klass and its subclasses are rebuilt.
+static void klass_thaw(Klass* klass)
+{
+  if (not klasses_frozen) return;
+  for (uint i = 0; i < klasses.size; i++){
+    Klass* k = array_get(&klasses, Klass*, i);
+    while (k != NULL and k != klass) k = k->parent;
+    if (k != NULL) klass_freeze(array_get(&klasses, Klass*, i));
+  }
+}
+
+// Look key up in table t.  Before phase 1.5 the tables are empty, and the
+// Dict d of the class itself is used instead.
+static bool klass_lookup(KlassTable* t, Dict* d, Value key, Value* value)
+{
+  if (klasses_frozen) return klass_table_get(t, key, value);
+  return dict_query(d, &key, value);
+}
+
 // Create Klass structure and add it to the dictionary.
 Klass* klass_new(Value name, int cdata_size)
 {
@@ -60,9 +171,13 @@ Klass* klass_new(Value name, int cdata_size)
             dict_hash_uint32, dict_equal_uint32);
   klass->num_fields = 0;
   klass->destructor = VALUE_NIL;
+  klass->t_methods = empty_table;
+  klass->t_readable = empty_table;
+  klass->t_writable = empty_table;
 
   array_append(&klasses, klass);
   dict_set(&dsym_to_klass, &name, &klass);
+  klass_thaw(klass);
 
   return klass;
 }
@@ -78,6 +193,7 @@ int klass_new_field(Klass* klass, Value name, int type)
   if (type & FIELD_WRITABLE){
     dict_set(&(klass->writable_fields), &name, &field_num);
   }
+  klass_thaw(klass);
   return field_num;
 }
 
@@ -97,11 +213,13 @@ int klass_get_field_int(Klass* klass, Value name)
 void klass_new_virtual_reader(Klass* klass, Value name, Value func)
 {
   dict_set(&(klass->readable_fields), &name, &func);
+  klass_thaw(klass);
 }
 
 void klass_new_virtual_writer(Klass* klass, Value name, Value func)
 {
   dict_set(&(klass->writable_fields), &name, &func);
+  klass_thaw(klass);
 }
 
 void klass_new_method(Klass* klass, Value name, Value method)
@@ -109,6 +227,7 @@ void klass_new_method(Klass* klass, Value name, Value method)
   if (name == dsym_destructor){
     klass->destructor = (CFunc1) func_get_ptr(method, 1);
   } else dict_set(&(klass->methods), &name, &method);
+  klass_thaw(klass);
 }
 
 void klass_init_phase15()
@@ -120,6 +239,7 @@ void klass_init_phase15()
     }
     klass->obj_size = sizeof(Klass*) + klass->num_fields * sizeof(Value) + klass->cdata_size;
   }
+  klass_freeze_all();
 }
 
 Klass* klass_get(Value name)
@@ -148,7 +268,7 @@ Value obj_new2(Klass* klass)
 
 void obj_destroy(Value obj)
 {
-  if ((obj & MASK_TAIL) == 0){ // Only destroy objects (not direct values)
+  if (value_tag(obj) == TAG_PTR){ // Only destroy objects (not direct values)
     Klass* klass = obj_klass(obj);
     
     // Call destructor if it exists
@@ -179,7 +299,8 @@ Value field_get(Value v_obj, Value field)
 {
   Klass* klass = obj_klass(v_obj);
   uint64 field_num;
-  if (dict_query(&(klass->readable_fields), &field, &field_num)){
+  if (klass_lookup(klass->t_readable, &(klass->readable_fields), field,
+                   &field_num)){
     if (field_num < 1024){
       Value* c_data = obj_c_data(v_obj);
       return c_data[field_num];
@@ -197,7 +318,8 @@ void field_set(Value v_obj, Value field, Value val)
 {
   Klass* klass = obj_klass(v_obj);
   uint64 field_num;
-  if (dict_query(&(klass->writable_fields), &field, &field_num)){
+  if (klass_lookup(klass->t_writable, &(klass->writable_fields), field,
+                   &field_num)){
     if (field_num < 1024){
       Value* c_data = obj_c_data(v_obj);
       c_data[field_num] = val;
@@ -214,7 +336,9 @@ void field_set(Value v_obj, Value field, Value val)
 bool field_has(Value v_obj, Value field)
 {
   Klass* klass = obj_klass(v_obj);
-  return dict_query(&(klass->readable_fields), &field, NULL);
+  Value dummy;
+  return klass_lookup(klass->t_readable, &(klass->readable_fields), field,
+                      &dummy);
 }
 
 void method_error(Klass* klass, Value dsym)
@@ -223,10 +347,22 @@ void method_error(Klass* klass, Value dsym)
             dsym_reverse_get(klass->name), dsym_reverse_get(dsym));
 }
 
+Value method_get_slow(Klass* klass, Value dsym)
+{
+  // method_get() already missed in the table.
+  Value method;
+  if (not klasses_frozen and dict_query(&(klass->methods), &dsym, &method)){
+    return method;
+  }
+  method_error(klass, dsym);
+  return VALUE_NIL;
+}
+
 bool method_has(Value v_obj, Value dsym)
 {
   Klass* klass = obj_klass(v_obj);
-  return dict_query(&(klass->methods), &dsym, NULL);
+  Value dummy;
+  return klass_lookup(klass->t_methods, &(klass->methods), dsym, &dummy);
 }
 
 bool obj_eq_klass(Value v_obj, Klass* k)
@@ -17,22 +17,22 @@
 #include <string.h>
 
 const char* c_template_int =
-"Value op_%s(Value a, Value b)\n"
+"Value op_%s_slow(Value a, Value b)\n"
 "{\n"
-"  switch(a & MASK_TAIL){\n"
-"    case 0b00:\n"
+"  switch(value_tag(a)){\n"
+"    case TAG_PTR:\n"
 "      return method_call1(a, dsym_%s, b);\n"
-"    case 0b01:\n"
-"      switch(b & MASK_TAIL){\n"
-"        case 0b00:\n"
+"    case TAG_INT64:\n"
+"      switch(value_tag(b)){\n"
+"        case TAG_PTR:\n"
 "          return method_call1(b, dsym_%s2, a);\n"
-"        case 0b01:\n"
+"        case TAG_INT64:\n"
 "          return pack_int64(unpack_int64(a) %s unpack_int64(b));\n"
-"        case 0b10:\n"
+"        case TAG_DOUBLE:\n"
 "        default:\n"
 "          goto error;\n"
 "      }\n"
-"    case 0b10:\n"
+"    case TAG_DOUBLE:\n"
 "      goto error;\n"
 "  }\n"
 "error:\n"
@@ -42,29 +42,29 @@ const char* c_template_int =
 "}\n";
 
 const char* c_template =
-"Value op_%s(Value a, Value b)\n"
+"Value op_%s_slow(Value a, Value b)\n"
 "{\n"
-"  switch(a & MASK_TAIL){\n"
-"    case 0b00:\n"
+"  switch(value_tag(a)){\n"
+"    case TAG_PTR:\n"
 "      return method_call1(a, dsym_%s, b);\n"
-"    case 0b01:\n"
-"      switch(b & MASK_TAIL){\n"
-"        case 0b00:\n"
+"    case TAG_INT64:\n"
+"      switch(value_tag(b)){\n"
+"        case TAG_PTR:\n"
 "          return method_call1(b, dsym_%s2, a);\n"
-"        case 0b01:\n"
+"        case TAG_INT64:\n"
 "          return pack_%s(unpack_int64(a) %s unpack_int64(b));\n"
-"        case 0b10:\n"
+"        case TAG_DOUBLE:\n"
 "          return pack_%s(((double) unpack_int64(a)) %s unpack_double(b));\n"
 "        default:\n"
 "          goto error;\n"
 "      }\n"
-"    case 0b10:\n"
-"      switch(b & MASK_TAIL){\n"
-"        case 0b00:\n"
+"    case TAG_DOUBLE:\n"
+"      switch(value_tag(b)){\n"
+"        case TAG_PTR:\n"
 "          return method_call1(b, dsym_%s2, a);\n"
-"        case 0b01:\n"
+"        case TAG_INT64:\n"
 "          return pack_%s(unpack_double(a) %s ((double) unpack_int64(b)));\n"
-"        case 0b10:\n"
+"        case TAG_DOUBLE:\n"
 "          return pack_%s(unpack_double(a) %s unpack_double(b));\n"
 "        default:\n"
 "          goto error;\n"
@@ -76,7 +76,50 @@ const char* c_template =
 "            klass_name(obj_klass(b)));\n"
 "}\n";
 
-const char* h_template = "Value op_%s(Value a, Value b);\n";
+// The header gets static inline versions of each operator that handle
+// the common numeric cases directly and call the out-of-line op_*_slow
+// functions above for everything else.
+const char* h_template_int =
+"Value op_%s_slow(Value a, Value b);\n"
+"static inline Value op_%s(Value a, Value b)\n"
+"{\n"
+"  if (is_int64(a) and is_int64(b))\n"
+"    return pack_int64(unpack_int64(a) %s unpack_int64(b));\n"
+"  return op_%s_slow(a, b);\n"
+"}\n\n";
+
+const char* h_template =
+"Value op_%s_slow(Value a, Value b);\n"
+"static inline Value op_%s(Value a, Value b)\n"
+"{\n"
+"  if (is_int64(a) and is_int64(b))\n"
+"    return pack_%s(unpack_int64(a) %s unpack_int64(b));\n"
+"  if (is_double(a) and is_double(b))\n"
+"    return pack_%s(unpack_double(a) %s unpack_double(b));\n"
+"  return op_%s_slow(a, b);\n"
+"}\n\n";
+
+typedef struct {
+  const char* name;
+  const char* op;
+  const char* result;  // Result type of a numeric operation, NULL for ints
+} Operator;
+
+static Operator operators[] = {
+  {"plus",    "+",  "int64"},
+  {"minus",   "-",  "int64"},
+  {"star",    "*",  "int64"},
+  {"slash",   "/",  "int64"},
+  {"gt",      ">",  "bool"},
+  {"gte",     ">=", "bool"},
+  {"lt",      "<",  "bool"},
+  {"lte",     "<=", "bool"},
+  {"bit_and", "&",  NULL},
+  {"bit_or",  "|",  NULL},
+  {"bit_xor", "^",  NULL},
+  {"modulo",  "%",  NULL},
+  {NULL,      NULL, NULL}
+};
 
 static void func_numeric_numeric(const char* name, const char* op){
   printf(c_template,
@@ -112,18 +155,15 @@ static void gen_c(void)
   printf("// ops-generated source file\n\n");
 
   printf("#include \"vm/ops-generated.h\"\n\n");
-  func_numeric_numeric("plus", "+");
-  func_numeric_numeric("minus", "-");
-  func_numeric_numeric("star", "*");
-  func_numeric_numeric("slash", "/");
-  func_bool_numeric("gt", ">");
-  func_bool_numeric("gte", ">=");
-  func_bool_numeric("lt", "<");
-  func_bool_numeric("lte", "<=");
-  func_int_int("bit_and", "&");
-  func_int_int("bit_or", "|");
-  func_int_int("bit_xor", "^");
-  func_int_int("modulo", "%");
+  for (Operator* o = operators; o->name != NULL; o++){
+    if (o->result == NULL){
+      func_int_int(o->name, o->op);
+    } else if (strcmp(o->result, "bool") == 0){
+      func_bool_numeric(o->name, o->op);
+    } else {
+      func_numeric_numeric(o->name, o->op);
+    }
+  }
 }
 
 static void gen_h(void)
@@ -135,18 +175,17 @@ static void gen_h(void)
 
   printf("#include \"vm/vm.h\"\n\n");
 
-  printf(h_template, "plus");
-  printf(h_template, "minus");
-  printf(h_template, "star");
-  printf(h_template, "slash");
-  printf(h_template, "gt");
-  printf(h_template, "gte");
-  printf(h_template, "lt");
-  printf(h_template, "lte");
-  printf(h_template, "bit_and");
-  printf(h_template, "bit_or");
-  printf(h_template, "bit_xor");
-  printf(h_template, "modulo");
+  for (Operator* o = operators; o->name != NULL; o++){
+    const char* name = o->name;
+    const char* op = o->op;
+    if (o->result == NULL){
+      printf(h_template_int, name, name, op, name);
+    } else {
+      const char* d_result = strcmp(o->result, "bool") == 0 ? "bool"
+                                                             : "double";
+      printf(h_template, name, name, o->result, op, d_result, op, name);
+    }
+  }
   printf("#endif\n");
 }
 
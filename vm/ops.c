@@ -15,6 +15,28 @@
 
 #include "vm/vm.h"
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+uint64 hash_seed;
+
+void hash_init()
+{
+  const char* seed = getenv("RIPE_HASH_SEED");
+  if (seed != NULL){
+    hash_seed = strtoull(seed, NULL, 0);
+    return;
+  }
+  FILE* f = fopen("/dev/urandom", "rb");
+  if (f != NULL){
+    if (fread(&hash_seed, sizeof(hash_seed), 1, f) != 1) hash_seed = 0;
+    fclose(f);
+  }
+  if (hash_seed == 0){
+    hash_seed = hash_mix64((uint64) time(NULL) ^ ((uint64) getpid() << 32)
+                           ^ (uint64) (uintptr_t) &seed);
+  }
+}
 
 static int64 ipow(int64 b, int64 e)
 {
@@ -30,14 +52,14 @@ static int64 ipow(int64 b, int64 e)
 
 Value op_exp(Value a, Value b)
 {
-  switch(a & MASK_TAIL){
-    case 0b00:
+  switch(value_tag(a)){
+    case TAG_PTR:
       goto error;
-    case 0b01:
-      switch(b & MASK_TAIL){
-        case 0b00:
+    case TAG_INT64:
+      switch(value_tag(b)){
+        case TAG_PTR:
           goto error;
-        case 0b01:
+        case TAG_INT64:
           {
             int64 e = unpack_int64(b);
             int64 n = unpack_int64(a);
@@ -46,18 +68,18 @@ Value op_exp(Value a, Value b)
             }
             return pack_int64(ipow(n, e));
           }
-        case 0b10:
+        case TAG_DOUBLE:
           return pack_double(pow((double) unpack_int64(a), unpack_double(b)));
         default:
           goto error;
       }
-    case 0b10:
-      switch(b & MASK_TAIL){
-        case 0b00:
+    case TAG_DOUBLE:
+      switch(value_tag(b)){
+        case TAG_PTR:
           goto error;
-        case 0b01:
+        case TAG_INT64:
           return pack_double(pow(unpack_double(a), (double) unpack_int64(b)));
-        case 0b10:
+        case TAG_DOUBLE:
           return pack_double(pow(unpack_double(a), unpack_double(b)));
         default:
           goto error;
@@ -71,28 +93,27 @@ error:
 
 int64 op_hash(Value v)
 {
-  switch(v & MASK_TAIL){
-    case 0b00:
+  switch(value_tag(v)){
+    case TAG_PTR:
       {
         Klass* k = obj_klass(v);
         if (k == klass_String) {
-          String* string = obj_c_data(v);
-          return hash_string(string->str);
+          return string_hash(obj_c_data(v));
         } else if (k == klass_Tuple) {
-          uint64 h = 89;
           Tuple* tuple = obj_c_data(v);
           int64 size = tuple->size;
+          uint64 h = hash_seed ^ size;
           for (int64 i = 0; i < size; i++){
-            h += op_hash(tuple->data[i]);
+            h = hash_combine(h, op_hash(tuple->data[i]));
           }
           return h;
         }
-        return hash_value(v);
+        return hash_mix64(v ^ hash_seed);
       }
-    case 0b01:
-    case 0b10:
-    case 0b11:
-      return unpack_int64(v);
+    case TAG_INT64:
+    case TAG_DOUBLE:
+    case TAG_EXTENDED:
+      return hash_mix64(v ^ hash_seed);
   }
   assert_never();
 
@@ -115,7 +136,11 @@ static inline bool op_equal3(Value a, Value b)
   if (obj_klass(a) == klass_String
        and
       obj_klass(b) == klass_String){
-    return strcmp(val_to_string(a), val_to_string(b)) == 0;
+    String* sa = obj_c_data(a);
+    String* sb = obj_c_data(b);
+    if (sa->size != sb->size) return false;
+    if (sa->hash != 0 and sb->hash != 0 and sa->hash != sb->hash) return false;
+    return memcmp(sa->str, sb->str, sa->size) == 0;
   }
   if (obj_klass(a) == klass_Tuple
        and
@@ -167,10 +192,10 @@ Value op_unary_not(Value v)
 
 Value op_unary_minus(Value v)
 {
-  switch(v & MASK_TAIL){
-    case 0b01:
+  switch(value_tag(v)){
+    case TAG_INT64:
       return pack_int64(-unpack_int64(v));
-    case 0b10:
+    case TAG_DOUBLE:
       return pack_double(-unpack_double(v));
   }
   exc_raise("unary '-' called with non-numerical value");
@@ -178,7 +203,7 @@ Value op_unary_minus(Value v)
 
 Value op_unary_bit_not(Value v)
 {
-  if ((v & MASK_TAIL) == 0b01){
+  if (value_tag(v) == TAG_INT64){
     return pack_int64(~unpack_int64(v));
   }
   exc_raise("unary 'bit_not' called with non-integer value");
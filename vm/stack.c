@@ -14,28 +14,14 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "vm/vm.h"
-#include <setjmp.h>
 #include <stdarg.h>
 
-#define TYPE_ANNOT       1
-#define TYPE_CATCH_ALL   2
-#define TYPE_CATCH       3
-#define TYPE_FINALLY     4
-//#define TYPE_ANNOTATION 5
-typedef struct {
-  int type;
-  Klass* exc_type;
-  char jb[sizeof(jmp_buf)];
-  const char* annotation;
-} Element;
-
-#define STACK_SIZE 2000
-THREAD_LOCAL Element stack[STACK_SIZE];
-THREAD_LOCAL int stack_idx = 0;
-
-// TODO: Can these be made THREAD_LOCAL?
-THREAD_LOCAL jmp_buf exc_jb;
-THREAD_LOCAL jmp_buf exc_unwinding_jb;
+THREAD_LOCAL const char** stack_annots = NULL;
+THREAD_LOCAL int stack_annot_idx = 0;
+THREAD_LOCAL int stack_annot_size = 0;
+int stack_limit = STACK_LIMIT;
+THREAD_LOCAL ExcHandler* exc_handler = NULL;
+
 THREAD_LOCAL bool stack_unwinding = false;
 THREAD_LOCAL Value exc_obj;
 THREAD_LOCAL int stack_backup;
@@ -43,65 +29,60 @@ THREAD_LOCAL int stack_backup;
 void stack_init()
 {
   stack_unwinding = false;
+  const char* limit = getenv("RIPE_STACK_LIMIT");
+  if (limit != NULL and atoi(limit) > 0) stack_limit = atoi(limit);
 }
 
-#define copy_jmp_buf(d, s)  memcpy(d, s, sizeof(jmp_buf))
-
-void stack_push_catch_all()
-{
-  stack[stack_idx].type = TYPE_CATCH_ALL;
-  copy_jmp_buf(stack[stack_idx].jb, exc_jb);
-  stack_idx++;
-}
-
-void stack_push_catch(Klass* exc_type)
-{
-  stack[stack_idx].type = TYPE_CATCH;
-  stack[stack_idx].exc_type = exc_type;
-  copy_jmp_buf(stack[stack_idx].jb, exc_jb);
-  stack_idx++;
-}
-
-void stack_push_finally()
+void stack_set_limit(int limit)
 {
-  stack[stack_idx].type = TYPE_FINALLY;
-  copy_jmp_buf(stack[stack_idx].jb, exc_jb);
-  stack_idx++;
+  if (limit < 1) exc_raise("invalid stack limit %d", limit);
+  stack_limit = limit;
 }
 
-void stack_pop()
+int stack_get_limit()
 {
-  assert(stack_idx > 0);
-  stack_idx--;
+  return stack_limit;
 }
 
-void stack_annot_push(const char* annotation)
+// Called by stack_annot_push() when stack_annot_size entries are in use, or
+// stack_limit is reached.  stack_annot_size is the allocated size.  The
+// annotations are string constants, so the stack is not allocated through
+// the GC.
+void stack_annot_grow()
 {
-  stack[stack_idx].type = TYPE_ANNOT;
-  stack[stack_idx].annotation = annotation;
-  stack_idx++;
+  if (stack_annot_idx >= stack_limit){
+    Value obj = obj_new2(klass_StackOverflow);
+    field_set(obj, dsym_text,
+              string_to_val("stack overflow (too much recursion)"));
+    exc_raise_object(obj);
+  }
+  if (stack_annot_idx >= stack_annot_size){
+    int size = stack_annot_size == 0 ? 64 : 2 * stack_annot_size;
+    const char** annots = realloc(stack_annots, size * sizeof(const char*));
+    if (annots == NULL) exc_raise("out of memory for the stack");
+    stack_annots = annots;
+    stack_annot_size = size;
+  }
 }
 
-void stack_annot_pop()
+void stack_deinit()
 {
-  for(;;){
-    assert(stack_idx > 0);
-    stack_idx--;
-    if (stack[stack_idx].type == TYPE_ANNOT) break;
-  }
+  free(stack_annots);
+  stack_annots = NULL;
+  stack_annot_idx = 0;
+  stack_annot_size = 0;
 }
 
 void stack_display()
 {
-  for(int64 i = 0; i < stack_idx; i++){
-    const char* name = "invalid";
-    switch(stack[i].type){
-      case TYPE_ANNOT:
-        name = stack[i].annotation;
-        break;
+  for(int64 i = 0; i < stack_annot_idx; i++){
+    // Elide the middle of deep stacks.
+    if (i == 20 and stack_annot_idx > 40){
+      fprintf(stderr, "... (%d more)\n", stack_annot_idx - 40);
+      i = stack_annot_idx - 20;
     }
-
-    if (i == stack_idx - 1){
+    const char* name = stack_annots[i];
+    if (i == stack_annot_idx - 1){
       fprintf(stderr, "in %s():\n", name);
     } else {
       fprintf(stderr, "from %s():\n", name);
@@ -111,35 +92,25 @@ void stack_display()
 
 void stack_continue_unwinding()
 {
-  for(;;){
-    if (stack_idx == 0) break;
-    stack_idx--;
-
-    switch(stack[stack_idx].type){
-      case TYPE_ANNOT:
-        // Ignore.
-        break;
-      case TYPE_CATCH_ALL:
-        // Restore to this handler.
+  while (exc_handler != NULL){
+    ExcHandler* h = exc_handler;
+    exc_handler = h->prev;
+
+    switch(h->type){
+      case EXC_CATCH:
+        if (not obj_eq_klass(exc_obj, h->exc_type)) break;
+        // Fall through.
+      case EXC_CATCH_ALL:
         stack_unwinding = false;
-        copy_jmp_buf(exc_jb, stack[stack_idx].jb);
-        longjmp(exc_jb, 1);
-        break;
-      case TYPE_CATCH:
-        if (obj_eq_klass(exc_obj, stack[stack_idx].exc_type)){
-          stack_unwinding = false;
-          copy_jmp_buf(exc_jb, stack[stack_idx].jb);
-          longjmp(exc_jb, 1);
-        }
-        break;
-      case TYPE_FINALLY:
-        copy_jmp_buf(exc_jb, stack[stack_idx].jb);
-        longjmp(exc_jb, 1);
-        break;
+        stack_annot_idx = h->annot_idx;
+        exc_longjmp(h->jb);
+      case EXC_FINALLY:
+        stack_annot_idx = h->annot_idx;
+        exc_longjmp(h->jb);
     }
   }
 
-  stack_idx = stack_backup;
+  stack_annot_idx = stack_backup;
   stack_display();
   fprintf(stderr, "  uncaught exception of type %s",
           dsym_reverse_get(
@@ -189,7 +160,7 @@ void exc_raise(const char* format, ...)
 
 void exc_raise_object(Value obj)
 {
-  stack_backup = stack_idx;
+  stack_backup = stack_annot_idx;
   stack_unwinding = true;
   exc_obj = obj;
   stack_continue_unwinding();
@@ -15,8 +15,90 @@
 
 // This file is included from value.h
 
-// Value is a 64-bit value. It assumes that all pointers returned by malloc
-// are aligned to 4 bytes (last 2 bits are 0).
+// Value is a 64-bit value.  It assumes that all pointers returned by malloc
+// are aligned to 4 bytes (last 2 bits are 0).  There are two encodings: the
+// default one tags the last 2 bits, and VALUE_NANBOX stores doubles unmodified
+// and puts integers in the NaN space.  Either way, nil, false, true and eof
+// are the small constants below and value_tag() classifies a Value.
+
+// Specific values:
+#define VALUE_NIL   ((Value) 0b0000)
+#define VALUE_FALSE ((Value) 0b0100)
+#define VALUE_TRUE  ((Value) 0b1000)
+#define VALUE_EOF   ((Value) 0b1100)
+
+// Masks:
+#define MASK_TAIL     ((Value) 0b11)
+#define MASK_LONGTAIL ((Value) 0b1111)
+
+// Tags returned by value_tag():
+#define TAG_PTR       0b00  // Pointers and the specific values
+#define TAG_INT64     0b01
+#define TAG_DOUBLE    0b10
+#define TAG_EXTENDED  0b11
+
+typedef union {
+  uint64 ui;
+  double d;
+} ValueDoublePacker;
+
+#ifdef VALUE_NANBOX
+
+// Containers:
+//   Pointer (and specific values)
+//     00000000 0000000x xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxx00
+//   Double (IEEE bits + NANBOX_DOUBLE_OFFSET; NaNs are canonicalized)
+//     from 00000000 00000010 00000000 ... to 11111111 11110010 00000000 ...
+//   Integer (50-bit, two's complement)
+//     111111xx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx
+
+#define NANBOX_DOUBLE_OFFSET  ((Value) 1 << 49)
+#define NANBOX_INT64_TAG      ((Value) 0xFFFC000000000000ULL)
+#define NANBOX_INT64_BITS     50
+
+static inline int value_tag(Value v)
+{
+  if (v >= NANBOX_INT64_TAG) return TAG_INT64;
+  if (v >= NANBOX_DOUBLE_OFFSET) return TAG_DOUBLE;
+  return TAG_PTR;
+}
+static inline bool is_int64(Value v)
+{
+  return v >= NANBOX_INT64_TAG;
+}
+static inline bool is_double(Value v)
+{
+  return v - NANBOX_DOUBLE_OFFSET < NANBOX_INT64_TAG - NANBOX_DOUBLE_OFFSET;
+}
+static inline bool is_ptr(Value v)
+{
+  return v < NANBOX_DOUBLE_OFFSET and (v & MASK_LONGTAIL) != v;
+}
+
+static inline Value pack_double(double d)
+{
+  ValueDoublePacker vdp;
+  vdp.d = d;
+  if (d != d) vdp.ui = 0x7FF8000000000000ULL;
+  return vdp.ui + NANBOX_DOUBLE_OFFSET;
+}
+static inline double unpack_double(Value v)
+{
+  ValueDoublePacker vdp;
+  vdp.ui = v - NANBOX_DOUBLE_OFFSET;
+  return vdp.d;
+}
+
+static inline Value pack_int64(int64 i)
+{
+  return (((Value) i) & ~NANBOX_INT64_TAG) | NANBOX_INT64_TAG;
+}
+static inline int64 unpack_int64(Value v)
+{
+  return ((int64) (v << (64 - NANBOX_INT64_BITS))) >> (64 - NANBOX_INT64_BITS);
+}
+
+#else
 
 // Containers:
 //   Pointer
@@ -31,21 +113,15 @@
 //     00000000 00000000 00000000 00000000 00000000 00000000 00000000 00001100
 //   Integer
 //     xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxx01
-//   Double
+//   Double (last 2 bits of the mantissa are lost)
 //     xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxx10
 //   Extended:
 //     xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxxxx xxxxxx11
 
-// Specific values:
-#define VALUE_NIL   ((Value) 0b0000)
-#define VALUE_FALSE ((Value) 0b0100)
-#define VALUE_TRUE  ((Value) 0b1000)
-#define VALUE_EOF   ((Value) 0b1100)
-
-// Masks:
-#define MASK_TAIL     ((Value) 0b11)
-#define MASK_LONGTAIL ((Value) 0b1111)
-
+static inline int value_tag(Value v)
+{
+  return v & MASK_TAIL;
+}
 static inline bool is_int64(Value v)
 {
   return (v & MASK_TAIL) == 0b01;
@@ -59,11 +135,6 @@ static inline bool is_ptr(Value v)
   return (v & MASK_TAIL) == 0b00 and (v & MASK_LONGTAIL) != v;
 }
 
-typedef union {
-  uint64 ui;
-  double d;
-} ValueDoublePacker;
-
 static inline Value pack_double(double d)
 {
   ValueDoublePacker vdp;
@@ -86,6 +157,8 @@ static inline int64 unpack_int64(Value v)
   return ((int64) v) >> 2;
 }
 
+#endif
+
 static inline Value pack_ptr(void* p)
 {
   return (Value) ((uintptr) p);
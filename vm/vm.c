@@ -36,6 +36,9 @@ int main(int argc, char** argv)
   // Initialize stack and exception system
   stack_init();
 
+  // Initialize the seed of hashes
+  hash_init();
+
   // Initialize static symbol table
   sym_init();
 
@@ -55,6 +55,21 @@ extern Value dsym_to_s;
 //////////////////////////////////////////////////////////////////////////////
 #include "vm/func-generated.h"
 
+// Frozen dispatch table, keyed by dsym.  Open addressing with linear probing
+// on a power of 2 table; a zero key marks an empty slot (dsyms are never 0).
+// A table is never modified once it is published: a class that changes gets
+// new tables, each installed with a single pointer store, so that a lookup
+// in another thread sees either the old or the new table.
+typedef struct {
+  Value key;
+  Value value;
+} KlassSlot;
+
+typedef struct {
+  uint64 mask;
+  KlassSlot slots[];
+} KlassTable;
+
 struct KlassT {
   struct KlassT* parent;
   Value name;
@@ -66,9 +81,30 @@ struct KlassT {
   Dict fields;
   int obj_size;
   CFunc1 destructor;
+  // Filled in by klass_init_phase15 from the Dicts above, with the parent
+  // chain flattened in.  From then on, these are what the runtime looks
+  // things up in.
+  KlassTable* t_methods;
+  KlassTable* t_readable;
+  KlassTable* t_writable;
 };
 typedef struct KlassT Klass;
 
+static inline bool klass_table_get(KlassTable* t, Value key, Value* value)
+{
+  // dsyms are consecutive integers, so their values spread them evenly.
+  uint64 i = ((uint64) unpack_int64(key)) & t->mask;
+  for (;;){
+    KlassSlot* slot = &(t->slots[i]);
+    if (slot->key == key){
+      *value = slot->value;
+      return true;
+    }
+    if (slot->key == 0) return false;
+    i = (i + 1) & t->mask;
+  }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // common.c
 //////////////////////////////////////////////////////////////////////////////
@@ -82,6 +118,7 @@ extern Klass* klass_Destroyed;
 extern Klass* klass_Double;
 extern Klass* klass_Eof;
 extern Klass* klass_Error;
+extern Klass* klass_StackOverflow;
 extern Klass* klass_Function;
 extern Klass* klass_Integer;
 extern Klass* klass_Map;
@@ -104,9 +141,83 @@ void stack_display(void);
 void exc_raise(const char* format, ...) __attribute__ ((noreturn));
 void exc_raise_object(Value obj) __attribute__ ((noreturn));
 
-// Annotation stuff
-void stack_annot_push(const char* annotation);
-void stack_annot_pop(void);
+// Annotation stuff: the names of the functions being executed, for
+// stack_display().  Kept apart from the exception handlers.  Each thread's
+// stack starts small and grows on demand; past stack_limit entries, a push
+// raises StackOverflow.  The limit is STACK_LIMIT, or the RIPE_STACK_LIMIT
+// environment variable, and is shared by all threads.  A thread other than
+// the main one calls stack_deinit() before it exits.
+#define STACK_LIMIT 10000
+extern THREAD_LOCAL const char** stack_annots;
+extern THREAD_LOCAL int stack_annot_idx;
+extern THREAD_LOCAL int stack_annot_size;
+extern int stack_limit;
+void stack_annot_grow(void);
+void stack_deinit(void);
+void stack_set_limit(int limit);
+int stack_get_limit(void);
+static inline void stack_annot_push(const char* annotation)
+{
+  if (stack_annot_idx >= stack_annot_size or stack_annot_idx >= stack_limit)
+    stack_annot_grow();
+  stack_annots[stack_annot_idx] = annotation;
+  stack_annot_idx++;
+}
+
+// Exception handlers live on the C stack of the function that installs them,
+// linked through prev.  The jump buffer does not save the signal mask.  A
+// handler is installed with:
+//   ExcHandler h;
+//   exc_push(&h, EXC_CATCH_ALL, NULL);
+//   if (exc_setjmp(h.jb) == 0){
+//     ...
+//     exc_pop(&h);
+//   } else {
+//     ... (h is already removed)
+//   }
+// Returning from the function (RRETURN) removes its handlers.  After a
+// finally block, call stack_continue_unwinding() if stack_unwinding.
+#define EXC_CATCH_ALL  1
+#define EXC_CATCH      2
+#define EXC_FINALLY    3
+#ifdef __GNUC__
+typedef void* ExcJmpBuf[5];
+#define exc_setjmp(jb)   __builtin_setjmp(jb)
+#define exc_longjmp(jb)  __builtin_longjmp(jb, 1)
+#else
+typedef jmp_buf ExcJmpBuf;
+#define exc_setjmp(jb)   _setjmp(jb)
+#define exc_longjmp(jb)  _longjmp(jb, 1)
+#endif
+typedef struct ExcHandlerT {
+  struct ExcHandlerT* prev;
+  int type;
+  int annot_idx;
+  Klass* exc_type;
+  ExcJmpBuf jb;
+} ExcHandler;
+extern THREAD_LOCAL ExcHandler* exc_handler;
+static inline void exc_push(ExcHandler* h, int type, Klass* exc_type)
+{
+  h->prev = exc_handler;
+  h->type = type;
+  h->annot_idx = stack_annot_idx;
+  h->exc_type = exc_type;
+  exc_handler = h;
+}
+static inline void exc_pop(ExcHandler* h)
+{
+  exc_handler = h->prev;
+}
+void stack_continue_unwinding(void) __attribute__ ((noreturn));
+
+static inline void stack_annot_pop(void)
+{
+  stack_annot_idx--;
+  // Handlers of a function that returned from inside a try block.
+  while (exc_handler != NULL and exc_handler->annot_idx > stack_annot_idx)
+    exc_handler = exc_handler->prev;
+}
 static inline Value stack_annot_pop_pass(Value stuff)
 {
   stack_annot_pop();
@@ -114,13 +225,6 @@ static inline Value stack_annot_pop_pass(Value stuff)
 }
 #define  RRETURN(x)  return stack_annot_pop_pass(x)
 
-void stack_push_catch_all(void);
-void stack_pop(void);
-void stack_push_finally(void);
-void stack_push_catch(Klass* exc_type);
-void stack_continue_unwinding(void) __attribute__ ((noreturn));
-
-extern THREAD_LOCAL jmp_buf exc_jb;
 extern THREAD_LOCAL Value exc_obj;
 extern THREAD_LOCAL bool stack_unwinding;
 
@@ -157,34 +261,23 @@ void obj_destroy(Value obj);
 // Verify an object is of given type.
 static inline Klass* obj_klass(Value v_obj)
 {
-  Value v_masked = v_obj & MASK_LONGTAIL;
-  switch(v_masked){
-    case 0b0000:
-      if (v_masked == v_obj) return klass_Nil;
-      return *((Klass**) unpack_ptr(v_obj));
-    case 0b0100:
-      if (v_masked == v_obj) return klass_Bool;
-      return *((Klass**) unpack_ptr(v_obj));
-    case 0b1000:
-      if (v_masked == v_obj) return klass_Bool;
+  switch(value_tag(v_obj)){
+    case TAG_PTR:
+      switch(v_obj){
+        case VALUE_NIL:
+          return klass_Nil;
+        case VALUE_FALSE:
+        case VALUE_TRUE:
+          return klass_Bool;
+        case VALUE_EOF:
+          return klass_Eof;
+      }
       return *((Klass**) unpack_ptr(v_obj));
-    case 0b1100:
-      if (v_masked == v_obj) return klass_Eof;
-      return *((Klass**) unpack_ptr(v_obj));
-    case 0b0001:
-    case 0b0101:
-    case 0b1001:
-    case 0b1101:
+    case TAG_INT64:
       return klass_Integer;
-    case 0b0010:
-    case 0b0110:
-    case 0b1010:
-    case 0b1110:
+    case TAG_DOUBLE:
       return klass_Double;
-    case 0b0011:
-    case 0b0111:
-    case 0b1011:
-    case 0b1111:
+    case TAG_EXTENDED:
       assert_never();
   }
   assert_never();
@@ -220,18 +313,69 @@ Value field_get(Value v_obj, Value field);
 void field_set(Value v_obj, Value field, Value val);
 bool field_has(Value v_obj, Value field);
 
+// Field slot n of an object of a field class.  The compiler emits this
+// directly for @field, where the layout of self is known.
+#define obj_slot(v_obj, n)  (((Object*) unpack_ptr(v_obj))->values[n])
+
+// For receivers of a declared type: the slot is only trusted if the object
+// really is of that class, otherwise go through the field tables.
+static inline Value field_get_slot(Value v_obj, Klass* klass, int n,
+                                   Value field)
+{
+  if (obj_klass(v_obj) == klass) return obj_slot(v_obj, n);
+  return field_get(v_obj, field);
+}
+static inline void field_set_slot(Value v_obj, Klass* klass, int n,
+                                  Value field, Value val)
+{
+  if (obj_klass(v_obj) == klass) obj_slot(v_obj, n) = val;
+  else field_set(v_obj, field, val);
+}
+
 void method_error(Klass* klass, Value dsym);
 bool method_has(Value v_obj, Value dsym);
+Value method_get_slow(Klass* klass, Value dsym);
 static inline Value method_get(Value v_obj, Value dsym)
 {
   Klass* klass = obj_klass(v_obj);
   Value method;
-  if (dict_query(&(klass->methods), &dsym, &method)){
+  if (klass_table_get(klass->t_methods, dsym, &method)){
     return method;
-  } else {
-    method_error(klass, dsym);
-    return VALUE_NIL;
   }
+  return method_get_slow(klass, dsym);
+}
+
+// Method lookup through a per-call-site cache.  Each call site owns a
+// zero-initialized MethodCache; on a hit the Dict lookup is skipped
+// entirely.  On a miss the new entry is put in front and the oldest one
+// falls out, so a site alternating between two classes stays hot.  A miss
+// writes the klass and the func of a way separately, so a MethodCache must
+// not be shared between threads: declare it THREAD_LOCAL.
+#ifdef MCACHE_STATS
+extern uint64 mcache_hits;
+extern uint64 mcache_misses;
+#define MCACHE_COUNT(x)  (x)++
+#else
+#define MCACHE_COUNT(x)
+#endif
+static inline Func* method_cache_get(MethodCache* mc, Value v_obj, Value dsym)
+{
+  Klass* klass = obj_klass(v_obj);
+  for (int i = 0; i < MCACHE_WAYS; i++){
+    if (mc->klass[i] == klass){
+      MCACHE_COUNT(mcache_hits);
+      return mc->func[i];
+    }
+  }
+  MCACHE_COUNT(mcache_misses);
+  Func* func = obj_c_data(method_get(v_obj, dsym));
+  for (int i = MCACHE_WAYS - 1; i > 0; i--){
+    mc->klass[i] = mc->klass[i-1];
+    mc->func[i] = mc->func[i-1];
+  }
+  mc->klass[0] = klass;
+  mc->func[0] = func;
+  return func;
 }
 
 bool obj_eq_klass(Value v_obj, Klass* k);
@@ -239,6 +383,9 @@ bool obj_eq_klass(Value v_obj, Klass* k);
 //////////////////////////////////////////////////////////////////////////////
 // ops.c
 //////////////////////////////////////////////////////////////////////////////
+// Seed of op_hash, random for each process unless RIPE_HASH_SEED is set.
+extern uint64 hash_seed;
+void hash_init(void);
 int64 op_hash(Value v);
 Value op_equal(Value a, Value b);
 bool op_equal2(Value a, Value b);
@@ -277,11 +424,16 @@ int format_parse(const char* fstr, FormatParse* fp);
 // Arrays.c
 //////////////////////////////////////////////////////////////////////////////
 
+// Arrays of up to ARRAY1_SMALL elements keep them in small, inside the
+// object.  Larger arrays spill to a separate block.
+#define ARRAY1_SMALL  4
 typedef struct {
   uint64 alloc_size;
   uint64 size;
   Value* data;
+  Value small[ARRAY1_SMALL];
 } Array1;
+void array1_init(Array1* a, uint64 alloc_size);
 Array1* val_to_array1(Value array1);
 Value array1_to_val(int64 num_elements, Value* data);
 Value array1_to_val2(int num_args, ...);
@@ -290,6 +442,17 @@ Value array1_index(Array1* array1, int64 idx);
 Value array1_new(int64 num_elements);
 void array1_push(Array1* a, Value val);
 Value array1_pop(Array1* a);
+// array1_index() and array1_index_set() with positive indices handled inline.
+static inline Value array1_index_fast(Array1* a, int64 idx)
+{
+  if ((uint64) (idx - 1) < a->size) return a->data[idx - 1];
+  return array1_index(a, idx);
+}
+static inline void array1_index_set_fast(Array1* a, int64 idx, Value val)
+{
+  if ((uint64) (idx - 1) < a->size) a->data[idx - 1] = val;
+  else array1_index_set(a, idx, val);
+}
 
 typedef struct {
   uint64 size_x;
@@ -322,7 +485,12 @@ void val_to_complex_soft(Value v, double* real, double* imag);
 // Double.c
 //////////////////////////////////////////////////////////////////////////////
 #define double_to_val(x) pack_double(x)
-double val_to_double(Value v);
+double val_to_double_slow(Value v);
+static inline double val_to_double(Value v)
+{
+  if (is_double(v)) return unpack_double(v);
+  return val_to_double_slow(v);
+}
 
 //////////////////////////////////////////////////////////////////////////////
 // Function.c
@@ -337,33 +505,92 @@ void* func_get_ptr(Value v_func, int16 num_params);
 // TODO: Change this if you want stack with optimizations
 #define FUNC_CALL(f, ...)   f(__VA_ARGS__)
 
+// Calling a generator function (one that yields) returns a Generator.  Each
+// call to resume() runs the body until its next yield and returns the
+// yielded value, or VALUE_EOF once the body has finished.  frame holds the
+// state and the locals of the body.
+typedef struct {
+  Value (*resume)(void* frame);
+  void* frame;
+} Generator;
+extern Klass* klass_Generator;
+Value generator_to_val(Value (*resume)(void* frame), void* frame);
+
 //////////////////////////////////////////////////////////////////////////////
 // HashTable.c
 //////////////////////////////////////////////////////////////////////////////
-typedef enum {
-  BUCKET_EMPTY = 0,
-  BUCKET_WAS_FULL,
-  BUCKET_FULL
-} BucketType;
+// Entries are kept in insertion order in keys and values, up to count; a
+// removed entry has the key HT_REMOVED (use ht_live() to walk them).  Lookups
+// go through alloc_size slots, each with a control byte: CTRL_EMPTY,
+// CTRL_DELETED, or CTRL_FULL with 7 bits of the key's hash, in which case
+// index holds the entry.
+#define CTRL_EMPTY    0x00
+#define CTRL_DELETED  0x01
+#define CTRL_FULL     0x80
+#define HT_GROUP      16
+
+extern uint64 ht_removed_entry[2];
+#define HT_REMOVED    ((Value) ht_removed_entry)
 
 typedef struct {
   uint64 size;
-  uint64 alloc_size;
-  BucketType* buckets;
+  uint64 alloc_size;     // A power of 2, at least HT_GROUP.
+  uint64 deleted;
+  uint8* ctrl;
+  uint32* index;
+  uint64 count;
+  uint64 entries_alloc;
   Value* keys;
-  Value* values;
+  Value* values;         // NULL for a Set.
 } HashTable;
 
+static inline bool ht_live(HashTable* ht, uint64 entry)
+{
+  return ht->keys[entry] != HT_REMOVED;
+}
+
 bool ht_query(HashTable* ht, Value key);
 bool ht_query2(HashTable* ht, Value key, Value* value);
 void ht_set(HashTable* ht, Value key);
 void ht_set2(HashTable* ht, Value key, Value value);
 bool ht_remove(HashTable* ht, Value key);
 void ht_clear(HashTable* ht);
+// Makes room for items keys in total.
+void ht_reserve(HashTable* ht, int64 items);
 void ht_init(HashTable* ht, int64 items);
 void ht_init2(HashTable* ht, int64 items);
 Value ht_new_map(int64 num, ...);
 Value ht_new_set(int64 num, ...);
+HashTable* val_to_map(Value v_map);
+HashTable* val_to_set(Value v_set);
+
+// Like the slots of a HashTable, but for keys that are all Integers or all
+// Strings, stored in the slots themselves.  keys holds the Integers, or the
+// hashes of the Strings in strings.
+typedef struct {
+  uint64 size;
+  uint64 alloc_size;
+  uint64 deleted;
+  uint64 removed;     // Since the last rehash.
+  uint8* ctrl;
+  int64* keys;
+  Value* strings;     // NULL for Integer keys.
+  Value* values;      // NULL for a set.
+} TypedTable;
+
+static inline bool tt_full(TypedTable* tt, uint64 place)
+{
+  return tt->ctrl[place] & CTRL_FULL;
+}
+
+void tt_init(TypedTable* tt, bool string_keys, bool do_values, int64 items);
+// Returns the place of key, or -1 (also if key has the wrong type).
+int64 tt_find(TypedTable* tt, Value key);
+// Returns the place of key, adding it if it is missing.  Raises if key has
+// the wrong type.
+uint64 tt_insert(TypedTable* tt, Value key);
+bool tt_remove(TypedTable* tt, Value key);
+Value tt_key(TypedTable* tt, uint64 place);
 
 //////////////////////////////////////////////////////////////////////////////
 // Integer.c
@@ -371,22 +598,37 @@ Value ht_new_set(int64 num, ...);
 void init1_Integer(void);
 void init2_Integer(void);
 #define int64_to_val(a) pack_int64(a)
-#define val_to_int64(v)  ({ obj_verify(v, klass_Integer); unpack_int64(v); })
+static inline int64 val_to_int64(Value v)
+{
+  obj_verify(v, klass_Integer);
+  return unpack_int64(v);
+}
 int64 val_to_int64_soft(Value v);
 // Put a pointer into an Integer.
+#ifdef VALUE_NANBOX
 static inline Value ptr_to_val(void* p)
 {
-  return (Value) ((uintptr) p) + 1;
+  return (Value) ((uintptr) p) | NANBOX_INT64_TAG;
 }
-static void* val_to_ptr(Value v)
+static inline void* val_to_ptr_unsafe(Value v)
 {
-  obj_verify(v, klass_Integer);
-  return (void*) (((uintptr) v) - 1);
+  return (void*) ((uintptr) (v & ~NANBOX_INT64_TAG));
+}
+#else
+static inline Value ptr_to_val(void* p)
+{
+  return (Value) ((uintptr) p) + 1;
 }
 static inline void* val_to_ptr_unsafe(Value v)
 {
   return (void*) (((uintptr) v) - 1);
 }
+#endif
+static void* val_to_ptr(Value v)
+{
+  obj_verify(v, klass_Integer);
+  return val_to_ptr_unsafe(v);
+}
 
 //////////////////////////////////////////////////////////////////////////////
 // Num.c
@@ -426,6 +668,59 @@ typedef struct {
 // Index should always be calculated via y*size_x + x
 // And loops should always be y outside, x inside
 
+// Map Ripe indices to the C index of an element (or throw an exception if
+// they are not valid).
+static inline uint64 num_array1_index(NumArray1* a, int64 x)
+{
+  if (x < 1 or (uint64) x > a->size){
+    exc_raise("invalid index (%"PRId64") in array of size (%"PRIu64")",
+              x, a->size);
+  }
+  return x - 1;
+}
+static inline uint64 num_array2_index(NumArray2* a, int64 x, int64 y)
+{
+  if (x < 1 or y < 1 or (uint64) x > a->size_x or (uint64) y > a->size_y){
+    exc_raise("invalid index (%"PRId64", %"PRId64") in array of "
+              "size (%"PRIu64" x %"PRIu64")", x, y, a->size_x, a->size_y);
+  }
+  return (y-1)*a->size_x + x-1;
+}
+
+// Get or set the element at C index idx of Num array data of the given type.
+static inline Value num_get(int type, void* data, uint64 idx)
+{
+  switch(type){
+    case NUM_DOUBLE:
+      return double_to_val(((double*) data)[idx]);
+    case NUM_INT:
+      return int64_to_val(((int64*) data)[idx]);
+    case NUM_INT8:
+      return int64_to_val(((int8*) data)[idx]);
+    case NUM_COMPLEX:
+    default:
+      assert_never();
+      return VALUE_NIL;
+  }
+}
+static inline void num_set(int type, void* data, uint64 idx, Value v)
+{
+  switch(type){
+    case NUM_DOUBLE:
+      ((double*) data)[idx] = val_to_double(v);
+      break;
+    case NUM_INT:
+      ((int64*) data)[idx] = val_to_int64(v);
+      break;
+    case NUM_INT8:
+      ((int8*) data)[idx] = (int8) val_to_int64(v);
+      break;
+    case NUM_COMPLEX:
+    default:
+      assert_never();
+  }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Object.c
 //////////////////////////////////////////////////////////////////////////////
@@ -455,21 +750,61 @@ Range* val_to_range(Value range);
 //////////////////////////////////////////////////////////////////////////////
 // String.c
 //////////////////////////////////////////////////////////////////////////////
+// A regular String is allocated as a single object with the bytes stored
+// right after the String structure (or, if made by a constructor or grown by
+// string_reserve(), in a separate atomic buffer).  A constant String points to
+// static memory.
 #define STRING_REGULAR  1
 #define STRING_CONST    2
 typedef struct {
   int type;
+  int64 size;   // In bytes, without the terminating 0.
+  int64 alloc;  // Bytes available at str, including the terminating 0.
+  uint64 hash;  // 0 if not computed yet.
   char* str;
 } String;
 
 char* val_to_string(Value v);
+int64 string_size(Value v);
+uint64 string_hash(String* s);
+// Call after modifying the contents of s in place.
+static inline void string_changed(String* s, int64 size)
+{
+  s->size = size;
+  s->hash = 0;
+}
+void string_reserve(Value v, int64 size);
 Value string_to_val(const char* str);
-Value stringn_to_val(const char* str, int n);
+Value stringn_to_val(const char* str, int64 n);
+// A new String with the contents of a followed by those of b.
+Value string_concat(String* a, String* b);
+// The String refers to str without copying it, and doesn't keep it alive for
+// the garbage collector: str must be in static storage.
 Value string_const_to_val(const char* str);
 
+// Perfect hash table over the cached hashes of the String labels of a switch
+// statement, built by string_switch_new() when the module is initialized.
+// If the hashes can't be separated, slots is NULL.
+typedef struct {
+  uint64 mult;
+  int shift;
+  int* slots;
+} StringSwitch;
+StringSwitch* string_switch_new(int n, Value* labels);
+// The 1-based index of the only label that v may be equal to, 0 if there is
+// none, or -1 if every label has to be tested.
+static inline int string_switch_get(StringSwitch* sw, Value v)
+{
+  if (sw->slots == NULL) return -1;
+  uint64 h = string_hash(obj_c_data(v));
+  return sw->slots[(h * sw->mult) >> sw->shift];
+}
+
 //////////////////////////////////////////////////////////////////////////////
 // Tuple.c
 //////////////////////////////////////////////////////////////////////////////
+// Tuples never resize, so the elements are stored inline, right after the
+// Tuple structure, and data points to them.
 typedef struct {
   int64 size;
   Value* data;